@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# Compares the time per bounded_sol_count call of dense and sparse sampling
+# hashes on the same instance and seed. The switch compared is
+# --sparsesampling 0/1; both arms count with --sparse 1, so ApproxMC's count
+# and the hash counts sampling starts from are the same and only the
+# sampling XORs differ.
+#
+# usage (from the build directory):
+#   ../scripts/bench/bench_sparse.py src-unigen/lumberjack ../m25_n25_s1_k1_loss0.1.B -- -c 25 -m 25
+#   ../scripts/bench/bench_sparse.py ./unigen formula.cnf
+
+import re
+import subprocess
+import sys
+import time
+
+def run(binary, instance, extra_args, sparse, seed):
+    cmd = [binary, instance, '--sparse', '1', '--sparsesampling', str(sparse),
+           '--seed', str(seed), '--verb', '1'] + extra_args
+    start = time.time()
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         universal_newlines=True).stdout
+    wall = time.time() - start
+
+    calls = len(re.findall(r'bounded_sol_count looking for', out))
+    m = re.search(r'Time to sample: ([0-9.]+) s', out)
+    if m is None or calls == 0:
+        print('ERROR: no sampling statistics in the output of: %s' % ' '.join(cmd))
+        sys.exit(-1)
+    return float(m.group(1)), calls, wall
+
+def main():
+    if len(sys.argv) < 3:
+        print('usage: %s BINARY INSTANCE [-- EXTRA ARGS]' % sys.argv[0])
+        sys.exit(-1)
+    binary, instance = sys.argv[1], sys.argv[2]
+    extra_args = sys.argv[4:] if len(sys.argv) > 3 and sys.argv[3] == '--' else sys.argv[3:]
+
+    seeds = [1, 2, 3]
+    per_call = {}
+    for sparse in [0, 1]:
+        total_time = 0.0
+        total_calls = 0
+        for seed in seeds:
+            t, calls, wall = run(binary, instance, extra_args, sparse, seed)
+            print('sparse=%d seed=%d sample time: %8.2f s  calls: %5d  wall: %8.2f s'
+                  % (sparse, seed, t, calls, wall))
+            total_time += t
+            total_calls += calls
+        per_call[sparse] = total_time / total_calls
+        print('sparse=%d time per solve call: %.4f s' % (sparse, per_call[sparse]))
+
+    if per_call[1] > 0:
+        print('speedup per solve call: %.2fx' % (per_call[0] / per_call[1]))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,83 @@
+/*
+ * cutcache.cpp
+ *
+ */
+
+#include "cutcache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char kCutCacheMagic[8] = {'L', 'J', 'C', 'U', 'T', 'S', '0', '1'};
+
+} // namespace
+
+CutCache::CutCache(const std::string& filename, uint64_t instance_hash)
+  : filename_(filename)
+  , instance_hash_(instance_hash)
+{
+}
+
+bool CutCache::load(std::vector<CutKey>& cuts) const
+{
+  std::ifstream in(filename_, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+
+  char magic[8];
+  uint64_t instance_hash = 0;
+  uint64_t num_cuts = 0;
+  in.read(magic, sizeof(magic));
+  in.read((char*)&instance_hash, sizeof(instance_hash));
+  in.read((char*)&num_cuts, sizeof(num_cuts));
+  if (!in || memcmp(magic, kCutCacheMagic, sizeof(magic)) != 0 || instance_hash != instance_hash_) {
+    return false;
+  }
+
+  std::vector<CutKey> read_cuts;
+  uint32_t record[6];
+  for (uint64_t i = 0; i < num_cuts; i++) {
+    if (!in.read((char*)record, sizeof(record))) {
+      return false;
+    }
+    CutKey key;
+    key.row1 = record[0];
+    key.row2 = record[1];
+    key.row3 = record[2];
+    key.col1 = record[3];
+    key.col2 = record[4];
+    key.code = record[5];
+    read_cuts.push_back(key);
+  }
+  cuts.swap(read_cuts);
+  return true;
+}
+
+bool CutCache::save(const std::vector<CutKey>& cuts) const
+{
+  // written next to the cache and renamed over it, so a run that dies
+  // halfway leaves the old cache
+  const std::string tmp_filename = filename_ + ".tmp";
+  {
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return false;
+    }
+
+    const uint64_t num_cuts = cuts.size();
+    out.write(kCutCacheMagic, sizeof(kCutCacheMagic));
+    out.write((const char*)&instance_hash_, sizeof(instance_hash_));
+    out.write((const char*)&num_cuts, sizeof(num_cuts));
+    for (const CutKey& key : cuts) {
+      const uint32_t record[6] = {key.row1, key.row2, key.row3, key.col1, key.col2, key.code};
+      out.write((const char*)record, sizeof(record));
+    }
+    if (!out) {
+      return false;
+    }
+  }
+  return std::rename(tmp_filename.c_str(), filename_.c_str()) == 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * cutcache.h
+ *
+ */
+
+#ifndef CUTCACHE_H
+#define CUTCACHE_H
+
+#include "cutpool.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// File of the cuts found for an instance, so later runs on the same
+/// instance can add them before counting. A cut is stored as its CutKey,
+/// which gives back the clause for the same input matrix.
+///
+/// Layout, in host byte order:
+///   char     magic[8]      "LJCUTS01"
+///   uint64_t instance_hash
+///   uint64_t num_cuts
+///   then num_cuts records of 6 uint32_t: row1, row2, row3, col1, col2, code
+class CutCache
+{
+public:
+  /// Constructor
+  /// @param filename cache file
+  /// @param instance_hash hash of everything the cuts depend on
+  CutCache(const std::string& filename, uint64_t instance_hash);
+
+  /// Reads the cuts saved for the instance
+  /// @return false if the file is missing, unreadable or for another instance
+  bool load(std::vector<CutKey>& cuts) const;
+
+  /// Replaces the file with the given cuts
+  /// @return false if the file could not be written
+  bool save(const std::vector<CutKey>& cuts) const;
+
+private:
+  const std::string filename_;
+  const uint64_t instance_hash_;
+};
+
+#endif // CUTCACHE_H
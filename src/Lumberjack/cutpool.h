@@ -0,0 +1,120 @@
+/*
+ * cutpool.h
+ *
+ */
+
+#ifndef CUTPOOL_H
+#define CUTPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+/// A forbidden submatrix cut, rows and columns in increasing order. Given the
+/// input matrix, the code of its entries determines the clause
+struct CutKey
+{
+  uint32_t row1, row2, row3;
+  uint32_t col1, col2;
+  uint32_t code;
+
+  bool operator==(const CutKey& other) const
+  {
+    return row1 == other.row1 && row2 == other.row2 && row3 == other.row3
+        && col1 == other.col1 && col2 == other.col2 && code == other.code;
+  }
+};
+
+struct CutKeyHash
+{
+  size_t operator()(const CutKey& key) const
+  {
+    uint64_t h = key.code;
+    for (uint32_t x : {key.row1, key.row2, key.row3, key.col1, key.col2})
+    {
+      h = (h ^ x) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 32);
+  }
+};
+
+/// Remembers the cuts handed to the solver, so none is added twice, and
+/// limits how many are added per separation round
+class CutPool
+{
+public:
+  /// Constructor
+  /// @param max_cuts_per_round 0 for no limit
+  explicit CutPool(size_t max_cuts_per_round)
+    : max_cuts_per_round_(max_cuts_per_round)
+  {
+  }
+
+  /// @return false if the cut was added before
+  bool insert(const CutKey& key)
+  {
+    return keys_.insert(key).second;
+  }
+
+  /// @param num_cuts cuts added so far this round
+  bool isRoundFull(size_t num_cuts) const
+  {
+    return max_cuts_per_round_ != 0 && num_cuts >= max_cuts_per_round_;
+  }
+
+  size_t size() const
+  {
+    return keys_.size();
+  }
+
+  const std::unordered_set<CutKey, CutKeyHash>& getKeys() const
+  {
+    return keys_;
+  }
+
+private:
+  const size_t max_cuts_per_round_;
+  std::unordered_set<CutKey, CutKeyHash> keys_;
+};
+
+/// Append-only list of the cuts found by the cutting planes of all sampling
+/// workers, so each can add what the others found instead of finding it again
+class SharedCutStore
+{
+public:
+  /// Appends cuts for the other workers to fetch
+  void publish(const std::vector<CutKey>& keys)
+  {
+    if (keys.empty())
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    keys_.insert(keys_.end(), keys.begin(), keys.end());
+    size_.store(keys_.size(), std::memory_order_release);
+  }
+
+  /// Appends the cuts published from position from on to out
+  /// @return position to fetch from next time
+  size_t fetch(size_t from, std::vector<CutKey>& out) const
+  {
+    // nothing new is the common case, no need to lock for it
+    if (size_.load(std::memory_order_acquire) == from)
+    {
+      return from;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.insert(out.end(), keys_.begin() + from, keys_.end());
+    return keys_.size();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<CutKey> keys_;
+  std::atomic<size_t> size_{0};
+};
+
+#endif // CUTPOOL_H
@@ -7,6 +7,7 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 using namespace CMSat;
 using std::vector;
@@ -18,7 +19,9 @@ CuttingPlaneDollo::CuttingPlaneDollo(SATSolver* solver,
                     StlIntMatrix& false_neg_vars,
                     StlIntMatrix& false_pos_vars,
                     StlIntVector& row_duplicate_vars,
-                    StlIntVector& col_duplicate_vars)
+                    StlIntVector& col_duplicate_vars,
+                    size_t num_threads,
+                    size_t max_cuts_per_round)
   : CuttingPlane(solver)
   , B_(B)
   , m_(B.getNrClones())
@@ -28,6 +31,10 @@ CuttingPlaneDollo::CuttingPlaneDollo(SATSolver* solver,
   , false_pos_vars_(false_pos_vars)
   , row_duplicate_vars_(row_duplicate_vars)
   , col_duplicate_vars_(col_duplicate_vars)
+  , forbidden_codes_(sortedForbiddenSubmatrixCodes())
+  , worker_pool_(std::max<size_t>(num_threads, 1))
+  , scratch_(worker_pool_.getNumWorkers())
+  , cut_pool_(max_cuts_per_round)
 {
 }
 
@@ -61,101 +68,362 @@ int CuttingPlaneDollo::getEntryAssignment(int p, int c) {
   throw std::runtime_error("Error: Solver did not assign truth value to variable.");
 }
 
-string CuttingPlaneDollo::getSubmatrixAsString(vector<pair<size_t, size_t>> positions) {
-  vector<int> submatrix_assignments;
+vector<Lit> CuttingPlaneDollo::getEntryIsNotLits(int p, int c, int value) {
+  // the entry is 2 iff lost, and 1 iff a false negative or, for a 1 in B,
+  // not a false positive
+  Lit is_two(loss_vars_[p][c], false);
+  Lit is_one = B_.getEntry(p, c) == 0 ? Lit(false_neg_vars_[p][c], false) : Lit(false_pos_vars_[p][c], true);
 
-  for (auto position : positions) {
-    submatrix_assignments.push_back(getEntryAssignment(position.first, position.second));
+  if (value == 0) {
+    return vector<Lit> {is_one, is_two};
+  } else if (value == 1) {
+    return vector<Lit> {~is_one};
   }
+  return vector<Lit> {~is_two};
+}
 
-  string submatrix_str;
+void CuttingPlaneDollo::decodeAssignment() {
+  assignment_.assign(((size_t)m_ * n_ + 31) / 32, 0);
+  value_rows_.assign((size_t)n_ * 3, PackedBits(packed_words(m_), 0));
+  for (size_t p = 0; p < m_; p++) {
+    for (size_t c = 0; c < n_; c++) {
+      const int entry = getEntryAssignment(p, c);
+      const size_t idx = p * n_ + c;
+      assignment_[idx / 32] |= (uint64_t)entry << (idx % 32 * 2);
+      set_packed_bit(value_rows_[c * 3 + entry], p);
+    }
+  }
+}
 
-  for (auto entry : submatrix_assignments) {
-    submatrix_str.append(std::to_string(entry));
+vector<pair<size_t, size_t>> CuttingPlaneDollo::getChangedEntries() const {
+  vector<pair<size_t, size_t>> changed;
+  for (size_t w = 0; w < assignment_.size(); w++) {
+    const uint64_t diff = assignment_[w] ^ prev_assignment_[w];
+    if (diff == 0) {
+      continue;
+    }
+    for (size_t k = 0; k < 32; k++) {
+      if ((diff >> (k * 2)) & 3) {
+        const size_t idx = w * 32 + k;
+        changed.emplace_back(idx / n_, idx % n_);
+      }
+    }
   }
+  return changed;
+}
 
-  return submatrix_str;
+void CuttingPlaneDollo::setEagerColumnPairs(const StlBoolMatrix& eager_col_pairs) {
+  eager_col_pairs_ = eager_col_pairs;
 }
 
-vector<Lit> CuttingPlaneDollo::getLits(int p, int c) {
-  int loss_var = loss_vars_[p][c];
-  Lit loss_lit(loss_var, getAssignment(loss_var) != l_True);
+void CuttingPlaneDollo::setReachableCodes(const vector<vector<uint32_t>>& reachable_codes) {
+  reachable_codes_ = reachable_codes;
+}
 
-  vector<Lit> lits { loss_lit };
+void CuttingPlaneDollo::setSharedCuts(SharedCutStore* shared_cuts) {
+  shared_cuts_ = shared_cuts;
+}
 
-  if (B_.getEntry(p, c) == 0) {
-    int false_neg_var = false_neg_vars_[p][c];
-    Lit false_neg_lit(false_neg_var, getAssignment(false_neg_var) != l_True);
+void CuttingPlaneDollo::setSolver(SATSolver* solver) {
+  solver_ = solver;
+  for (const CutKey& key : cut_pool_.getKeys()) {
+    addClause(getCutClause(key));
+  }
+  // the next model is separated in full, the new solver has never seen one
+  prev_assignment_.clear();
+}
 
-    lits.push_back(false_neg_lit);
-  } else {
-    int false_pos_var = false_pos_vars_[p][c];
-    Lit false_pos_lit(false_pos_var, getAssignment(false_pos_var) != l_True);
+int CuttingPlaneDollo::importSharedCuts() {
+  vector<CutKey> keys;
+  shared_cuts_read_ = shared_cuts_->fetch(shared_cuts_read_, keys);
 
-    lits.push_back(false_pos_lit);
+  int num_violated = 0;
+  for (const CutKey& key : keys) {
+    if (!cut_pool_.insert(key)) {
+      continue;
+    }
+    vector<Lit> clause = getCutClause(key);
+    bool violated = true;
+    for (Lit lit : clause) {
+      if (getAssignment(lit.var()) == (lit.sign() ? l_False : l_True)) {
+        violated = false;
+        break;
+      }
+    }
+    addClause(clause);
+    num_violated += violated;
   }
-
-  return lits;
+  return num_violated;
 }
 
 int CuttingPlaneDollo::separate() {
-  int num_cuts = 0;
-  for (size_t row1 = 0; row1 < m_; row1++) {
-    for (size_t row2 = 0; row2 < m_; row2++) {
-      if (row1 == row2) {
+  decodeAssignment();
+
+  // a cut another worker found may already rule out this model; separation
+  // below will not add it again, so it counts here
+  const int num_imported = shared_cuts_ != NULL ? importSharedCuts() : 0;
+
+  // after the first model, only submatrices with an entry that differs from
+  // the previous model are checked. Every other submatrix looks exactly as
+  // it did then, when it was already cut if forbidden
+  const bool incremental = !prev_assignment_.empty() && prev_complete_;
+  vector<bool> col_changed(n_, !incremental);
+  if (incremental) {
+    changed_rows_.assign(n_, PackedBits(packed_words(m_), 0));
+    for (auto entry : getChangedEntries()) {
+      set_packed_bit(changed_rows_[entry.second], entry.first);
+      col_changed[entry.second] = true;
+    }
+  }
+
+  // the column pairs to check, in the order of the serial scan
+  vector<pair<size_t, size_t>> col_pairs;
+  for (size_t col1 = 0; col1 < n_; col1++) {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++) {
+      if ((col_changed[col1] || col_changed[col2])
+          && (eager_col_pairs_.empty() || !eager_col_pairs_[col1][col2])
+          && (reachable_codes_.empty() || reachable_codes_[col1][col2] != 0)) {
+        col_pairs.emplace_back(col1, col2);
+      }
+    }
+  }
+
+  const int num_cuts = separateColumnPairs(col_pairs, incremental, prev_complete_);
+
+  std::swap(prev_assignment_, assignment_);
+  return num_cuts + num_imported;
+}
+
+int CuttingPlaneDollo::separateFixed(const vector<Lit>& fixed) {
+  vector<lbool> fixed_values;
+  for (Lit lit : fixed) {
+    if (lit.var() >= fixed_values.size()) {
+      fixed_values.resize(lit.var() + 1, l_Undef);
+    }
+    fixed_values[lit.var()] = lit.sign() ? l_False : l_True;
+  }
+  auto value = [&fixed_values](size_t var) {
+    return var < fixed_values.size() ? fixed_values[var] : l_Undef;
+  };
+
+  // only entries whose value is fixed go into value_rows_, so only
+  // submatrices with all six entries fixed are found
+  assignment_.assign(((size_t)m_ * n_ + 31) / 32, 0);
+  value_rows_.assign((size_t)n_ * 3, PackedBits(packed_words(m_), 0));
+  for (size_t p = 0; p < m_; p++) {
+    for (size_t c = 0; c < n_; c++) {
+      const lbool loss = value(loss_vars_[p][c]);
+      const lbool flipped = value(B_.getEntry(p, c) == 0 ? false_neg_vars_[p][c] : false_pos_vars_[p][c]);
+      int entry;
+      if (loss == l_True) {
+        entry = 2;
+      } else if (loss == l_False && flipped != l_Undef) {
+        entry = (B_.getEntry(p, c) == 0) == (flipped == l_True) ? 1 : 0;
+      } else {
         continue;
       }
-      for (size_t row3 = 0; row3 < m_; row3++) {
-        if (row3 == row2 || row3 == row1) {
-          continue;
-        }
-        for (size_t col1 = 0; col1 < n_; col1++) {
-          for (size_t col2 = 0; col2 < n_; col2++) {
-            if (col1 == col2) {
-              continue;
-            }
-
-            pair<size_t, size_t> b_11_pos(row1, col1);
-            pair<size_t, size_t> b_12_pos(row1, col2);
-
-            pair<size_t, size_t> b_21_pos(row2, col1);
-            pair<size_t, size_t> b_22_pos(row2, col2);
-
-            pair<size_t, size_t> b_31_pos(row3, col1);
-            pair<size_t, size_t> b_32_pos(row3, col2);
-
-            vector<pair<size_t, size_t>> positions {b_11_pos, b_12_pos, b_21_pos, b_22_pos, b_31_pos, b_32_pos};
-            string submatrix_str = getSubmatrixAsString(positions);
-
-            if (forbidden_submatrices_.find(submatrix_str) != forbidden_submatrices_.end()) {
-              // submatrix is forbidden
-              std::cout << "Submatrix found: " << *forbidden_submatrices_.find(submatrix_str) << std::endl;
-              vector<Lit> clause;
-              // get literals corresponding to each entry
-              for (auto position : positions) {
-                vector<Lit> entry_lits = getLits(position.first, position.second);
-                for (size_t i = 0; i < entry_lits.size(); i++) {
-                  // negate each one
-                  entry_lits[i] = ~entry_lits[i];
-                  clause.push_back(entry_lits[i]);
-                }
-              }
-              // add on literals that allow clause to be "violated" if a row or column is a duplicate
-              clause.push_back(Lit(row_duplicate_vars_[row1], false));
-              clause.push_back(Lit(row_duplicate_vars_[row2], false));
-              clause.push_back(Lit(row_duplicate_vars_[row3], false));
-
-              clause.push_back(Lit(col_duplicate_vars_[col1], false));
-              clause.push_back(Lit(col_duplicate_vars_[col2], false));
-
-              addClause(clause);
-              num_cuts++;
-            }
-          }
-        }
+      const size_t idx = p * n_ + c;
+      assignment_[idx / 32] |= (uint64_t)entry << (idx % 32 * 2);
+      set_packed_bit(value_rows_[c * 3 + entry], p);
+    }
+  }
+
+  vector<pair<size_t, size_t>> col_pairs;
+  for (size_t col1 = 0; col1 < n_; col1++) {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++) {
+      if ((eager_col_pairs_.empty() || !eager_col_pairs_[col1][col2])
+          && (reachable_codes_.empty() || reachable_codes_[col1][col2] != 0)) {
+        col_pairs.emplace_back(col1, col2);
       }
     }
   }
 
+  // cuts only add to what separate() relies on, its state is left as is
+  fixed_values_ = &fixed_values;
+  bool complete;
+  const int num_cuts = separateColumnPairs(col_pairs, false, complete);
+  fixed_values_ = NULL;
   return num_cuts;
-}
\ No newline at end of file
+}
+
+int CuttingPlaneDollo::separateColumnPairs(const vector<pair<size_t, size_t>>& col_pairs, bool incremental, bool& complete) {
+  for (auto& scratch : scratch_) {
+    scratch.cuts.clear();
+  }
+  worker_pool_.run(col_pairs.size(), [&](size_t worker, size_t item) {
+    separateColumnPair(item, col_pairs[item].first, col_pairs[item].second, incremental, scratch_[worker]);
+  });
+
+  // every worker found its cuts in increasing item order, so a stable sort
+  // by item gives the same cuts in the same order as a serial scan
+  vector<const Cut*> cuts;
+  for (const auto& scratch : scratch_) {
+    for (const Cut& cut : scratch.cuts) {
+      cuts.push_back(&cut);
+    }
+  }
+  std::stable_sort(cuts.begin(), cuts.end(), [](const Cut* a, const Cut* b) {
+    return a->item < b->item;
+  });
+  // cuts the model violates first, the others are only excused by duplicate rows or columns
+  std::stable_partition(cuts.begin(), cuts.end(), [](const Cut* cut) {
+    return cut->violated;
+  });
+
+  int num_cuts = 0;
+  complete = true;
+  vector<CutKey> added;
+  for (const Cut* cut : cuts) {
+    if (cut_pool_.isRoundFull(num_cuts)) {
+      // the cuts left out can be there unchanged in the next model
+      complete = false;
+      break;
+    }
+    if (!cut_pool_.insert(cut->key)) {
+      continue;
+    }
+    if (verbosity_ >= 3) {
+      std::cout << "Submatrix found: " << submatrixString(cut->key.code) << std::endl;
+    }
+    addClause(cut->clause);
+    added.push_back(cut->key);
+    num_cuts++;
+  }
+  if (shared_cuts_ != NULL) {
+    shared_cuts_->publish(added);
+  }
+  return num_cuts;
+}
+
+void CuttingPlaneDollo::separateColumnPair(size_t item, size_t col1, size_t col2, bool incremental, SeparationScratch& scratch) {
+  PackedBits* pair_rows = scratch.pair_rows;
+  PackedBits& changed_rows = scratch.changed_rows;
+  if (incremental) {
+    changed_rows.resize(changed_rows_[col1].size());
+    for (size_t w = 0; w < changed_rows.size(); w++) {
+      changed_rows[w] = changed_rows_[col1][w] | changed_rows_[col2][w];
+    }
+  }
+
+  // pair_rows[a * 3 + b] holds the rows with a in col1 and b in col2
+  uint32_t pair_count[9];
+  for (size_t a = 0; a < 3; a++) {
+    for (size_t b = 0; b < 3; b++) {
+      PackedBits& rows = pair_rows[a * 3 + b];
+      const PackedBits& rows_a = value_rows_[col1 * 3 + a];
+      const PackedBits& rows_b = value_rows_[col2 * 3 + b];
+      rows.resize(rows_a.size());
+      uint32_t count = 0;
+      for (size_t w = 0; w < rows.size(); w++) {
+        rows[w] = rows_a[w] & rows_b[w];
+        count += popcount64(rows[w]);
+      }
+      pair_count[a * 3 + b] = count;
+    }
+  }
+
+  // the codes have their rows sorted by value pair, v1 <= v2 <= v3
+  for (size_t i = 0; i < forbidden_codes_.size(); i++) {
+    if (!reachable_codes_.empty() && !((reachable_codes_[col1][col2] >> i) & 1)) {
+      continue;
+    }
+    const uint32_t code = forbidden_codes_[i];
+    // the value pairs of the three rows of the pattern
+    const uint32_t v1 = code / 81;
+    const uint32_t v2 = code / 9 % 9;
+    const uint32_t v3 = code % 9;
+
+    // every row has exactly one value pair, so three distinct rows exist iff
+    // every value pair has as many rows as the pattern uses it
+    if (pair_count[v1] < 1U + (v2 == v1) + (v3 == v1)
+        || pair_count[v2] < 1U + (v1 == v2) + (v3 == v2)
+        || pair_count[v3] < 1U + (v1 == v3) + (v2 == v3)) {
+      continue;
+    }
+
+    // rows with the same value pair are taken in increasing order, so every
+    // set of three rows comes up once
+    for_each_set_bit(pair_rows[v1], [&](size_t row1) {
+      for_each_set_bit(pair_rows[v2], [&](size_t row2) {
+        if (v2 == v1 && row2 <= row1) {
+          return;
+        }
+        for_each_set_bit(pair_rows[v3], [&](size_t row3) {
+          if (v3 == v2 && row3 <= row2) {
+            return;
+          }
+          if (incremental
+              && !get_packed_bit(changed_rows, row1)
+              && !get_packed_bit(changed_rows, row2)
+              && !get_packed_bit(changed_rows, row3)) {
+            return;
+          }
+          scratch.cuts.push_back(getSubmatrixCut(item, row1, row2, row3, col1, col2));
+        });
+      });
+    });
+  }
+}
+
+CuttingPlaneDollo::Cut CuttingPlaneDollo::getSubmatrixCut(size_t item, size_t row1, size_t row2, size_t row3, size_t col1, size_t col2) {
+  size_t rows[3] = {row1, row2, row3};
+  std::sort(rows, rows + 3);
+
+  Cut cut;
+  cut.item = item;
+  cut.key.row1 = rows[0];
+  cut.key.row2 = rows[1];
+  cut.key.row3 = rows[2];
+  cut.key.col1 = col1;
+  cut.key.col2 = col2;
+  cut.key.code = submatrixCode(getDecodedEntry(rows[0], col1) * 3 + getDecodedEntry(rows[0], col2),
+                               getDecodedEntry(rows[1], col1) * 3 + getDecodedEntry(rows[1], col2),
+                               getDecodedEntry(rows[2], col1) * 3 + getDecodedEntry(rows[2], col2));
+  cut.clause = getCutClause(cut.key);
+
+  // the entry literals are false in the model, the cut only does something
+  // now if no row or column is a duplicate either
+  cut.violated = true;
+  for (size_t i = cut.clause.size() - 5; i < cut.clause.size(); i++) {
+    const size_t var = cut.clause[i].var();
+    const lbool value = fixed_values_ == NULL ? getAssignment(var)
+      : var < fixed_values_->size() ? (*fixed_values_)[var] : l_Undef;
+    if (value == l_True) {
+      cut.violated = false;
+    }
+  }
+
+  return cut;
+}
+
+vector<Lit> CuttingPlaneDollo::getCutClause(const CutKey& key) {
+  pair<size_t, size_t> b_11_pos(key.row1, key.col1);
+  pair<size_t, size_t> b_12_pos(key.row1, key.col2);
+
+  pair<size_t, size_t> b_21_pos(key.row2, key.col1);
+  pair<size_t, size_t> b_22_pos(key.row2, key.col2);
+
+  pair<size_t, size_t> b_31_pos(key.row3, key.col1);
+  pair<size_t, size_t> b_32_pos(key.row3, key.col2);
+
+  vector<pair<size_t, size_t>> positions {b_11_pos, b_12_pos, b_21_pos, b_22_pos, b_31_pos, b_32_pos};
+  const vector<int> values = submatrixEntries(key.code);
+
+  vector<Lit> clause;
+  // forbid the values of the entries, not only the variables behind them, so
+  // the cut holds for every assignment showing the same submatrix
+  for (size_t i = 0; i < positions.size(); i++) {
+    for (Lit lit : getEntryIsNotLits(positions[i].first, positions[i].second, values[i])) {
+      clause.push_back(lit);
+    }
+  }
+  // add on literals that allow clause to be "violated" if a row or column is a duplicate
+  clause.push_back(Lit(row_duplicate_vars_[key.row1], false));
+  clause.push_back(Lit(row_duplicate_vars_[key.row2], false));
+  clause.push_back(Lit(row_duplicate_vars_[key.row3], false));
+
+  clause.push_back(Lit(col_duplicate_vars_[key.col1], false));
+  clause.push_back(Lit(col_duplicate_vars_[key.col2], false));
+
+  return clause;
+}
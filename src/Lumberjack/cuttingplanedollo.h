@@ -9,15 +9,18 @@
 #include <cryptominisat5/cryptominisat.h>
 #include "matrix.h"
 #include "utils.h"
+#include "forbiddensubmatrices.h"
+#include "workerpool.h"
+#include "cutpool.h"
+#include "../packedbits.h"
 #include <approxmc/cuttingplane.h>
+#include <cstdint>
 #include <utility>
 #include <vector>
-#include <unordered_set>
 
 using ApproxMC::CuttingPlane;
 using std::vector;
 using std::string;
-using std::unordered_set;
 using std::pair;
 
 /// This class provides a cutting plane wrapper for CryptoMiniSAT
@@ -33,9 +36,69 @@ public:
                     StlIntMatrix& false_neg_vars,
                     StlIntMatrix& false_pos_vars,
                     StlIntVector& row_duplicate_vars,
-                    StlIntVector& col_duplicate_vars);
+                    StlIntVector& col_duplicate_vars,
+                    size_t num_threads = 1,
+                    size_t max_cuts_per_round = 0);
+
+  /// Column pairs whose forbidden submatrices are already forbidden by the
+  /// formula, never separated
+  /// @param eager_col_pairs eager_col_pairs[col1][col2] for col1 < col2
+  void setEagerColumnPairs(const StlBoolMatrix& eager_col_pairs);
+
+  /// Forbidden submatrices that can show up at all in each column pair,
+  /// only those are separated
+  /// @param reachable_codes bit i of reachable_codes[col1][col2], col1 < col2,
+  /// is set if sortedForbiddenSubmatrixCodes()[i] can show up
+  void setReachableCodes(const vector<vector<uint32_t>>& reachable_codes);
+
+  /// Cuts found are published to the store, and cuts published by others
+  /// added before each separation
+  /// @param shared_cuts store shared with the other cutting planes, NULL for none
+  void setSharedCuts(SharedCutStore* shared_cuts);
+
+  /// Adds cuts for the forbidden submatrices whose entries are all fixed by
+  /// the given literals, such as those the solver fixed at decision level 0,
+  /// without waiting for a model
+  /// @return number of cuts added
+  int separateFixed(const vector<Lit>& fixed);
+
+  /// Moves the cutting plane to another solver over the same variables,
+  /// adding the cuts found so far to it
+  void setSolver(SATSolver* solver);
+
+  /// Prints every cut added from verbosity 3 on
+  void setVerbosity(uint32_t verbosity)
+  {
+    verbosity_ = verbosity;
+  }
+
+  /// Cuts added so far
+  const CutPool& getCutPool() const
+  {
+    return cut_pool_;
+  }
   
 protected:
+
+  /// A cut found by a worker, added to the solver once all are done
+  struct Cut {
+    /// Index of the column pair it was found in
+    size_t item;
+    CutKey key;
+    vector<Lit> clause;
+    /// Whether the current model violates the clause
+    bool violated;
+  };
+
+  /// Working memory of one separation worker
+  struct SeparationScratch {
+    /// Rows of each value pair in the column pair being separated
+    PackedBits pair_rows[9];
+    /// Rows with a changed entry in either column of the pair
+    PackedBits changed_rows;
+    /// Cuts found, in increasing order of item
+    vector<Cut> cuts;
+  };
   
   /// Get current assignment from solver and input
   /// @param p row (or clone)
@@ -43,24 +106,62 @@ protected:
   /// @return 0, 1, or 2
   int getEntryAssignment(int p, int c);
 
-  /// Get literals for loss, false negative, and false positive variables corresponding to entry p, c
+  /// Get literals over the loss, false negative, and false positive variables of entry p, c
+  /// that say the entry is not value, whatever the variables behind value are
   /// @param p row (or clone)
   /// @param c column (or mutation)
-  /// @return vector of literals that correspond to that entry's assignment
-  vector<Lit> getLits(int p, int c);
+  /// @param value 0, 1, or 2
+  /// @return vector of literals, one of which is true iff the entry is not value
+  vector<Lit> getEntryIsNotLits(int p, int c, int value);
   
   /// Identify violated constraint
   /// @return number of added constraints
   int separate();
 
-  /// Gets a submatrix whose positions are specified by positions as a string
-  /// @param positions a vector of pairs of indices describing which entries compose the submatrix
-  /// each pair in the vector represents a row, column position
-  /// @return a string representing the submatrix in row major order - for example, "100111" is
-  /// 1 0
-  /// 0 1
-  /// 1 1
-  string getSubmatrixAsString(vector<pair<size_t, size_t>> positions);
+  /// Decodes the current assignment of every entry into assignment_ and value_rows_
+  void decodeAssignment();
+
+  /// Entries of the decoded model that differ from prev_assignment_
+  vector<pair<size_t, size_t>> getChangedEntries() const;
+
+  /// Finds a cut for every forbidden submatrix in the given columns, col1 < col2,
+  /// looking for the rows of each pattern in per value pair row bitsets.
+  /// Every set of three rows is checked once, in whatever order makes it forbidden.
+  /// Only reads the model and the decoded matrices, so workers may run it
+  /// on different column pairs at the same time
+  /// @param item index of the column pair, stored with its cuts
+  /// @param incremental only check submatrices with a row in changed_rows_
+  /// @param scratch the calling worker's memory, receives the cuts
+  void separateColumnPair(size_t item, size_t col1, size_t col2, bool incremental, SeparationScratch& scratch);
+
+  /// Separates the given column pairs in parallel and adds the cuts found, at
+  /// most max_cuts_per_round of them, those violated first
+  /// @param incremental only check submatrices with a row in changed_rows_
+  /// @param complete set to whether all cuts found were added
+  /// @return number of cuts added
+  int separateColumnPairs(const vector<pair<size_t, size_t>>& col_pairs, bool incremental, bool& complete);
+
+  /// Adds the cuts other cutting planes published since the last call
+  /// @return number of them the current model violates
+  int importSharedCuts();
+
+  /// Gets the clause of a cut, given by its key
+  vector<Lit> getCutClause(const CutKey& key);
+
+  /// Gets the cut for the forbidden submatrix at the given rows, in any
+  /// order, and columns, col1 < col2
+  /// @param item index of the column pair
+  Cut getSubmatrixCut(size_t item, size_t row1, size_t row2, size_t row3, size_t col1, size_t col2);
+
+  /// Entry of the decoded model
+  /// @param p row (or clone)
+  /// @param c column (or mutation)
+  /// @return 0, 1, or 2
+  int getDecodedEntry(size_t p, size_t c) const
+  {
+    const size_t idx = p * n_ + c;
+    return (assignment_[idx / 32] >> (idx % 32 * 2)) & 3;
+  }
 
   vector<int> getSolutionInts(const vector<lbool>& model);
   
@@ -69,18 +170,12 @@ protected:
   /// Input matrix
   const Matrix& B_;
   /// Number of taxa
-  const int m_;
+  const size_t m_;
   /// Number of characters
-  const int n_;
+  const size_t n_;
   /// Number of allowed losses
   const int k_ = 1;
 
-  const unordered_set<string> forbidden_submatrices_ {"100111", "100112", "100211", "100212", "100121",
-                                            "100122", "100221", "100222", "200111", "200112",
-                                            "200211", "200212", "200121", "200122", "200221",
-                                            "200222", "110212", "110222", "210212", "210222",
-                                            "201121", "201122", "201221", "201222", "211222"};
-
   /// loss_vars maps matrix entries to loss variables
   StlIntMatrix& loss_vars_;
   /// false_neg_vars maps matrix entries to false neg variables
@@ -92,6 +187,39 @@ protected:
   StlIntVector& row_duplicate_vars_;
   /// col_duplicate_vars_ maps column indices to column duplicate variables
   StlIntVector& col_duplicate_vars_;
+
+  /// Entries (0, 1 or 2) of the model being separated, 2 bits each in row
+  /// major order, 32 to a word
+  vector<uint64_t> assignment_;
+  /// Entries of the model separated last time, empty before the first
+  vector<uint64_t> prev_assignment_;
+  /// value_rows_[c * 3 + v] holds the rows with value v in column c
+  vector<PackedBits> value_rows_;
+  /// changed_rows_[c] holds the rows whose entry in column c changed
+  vector<PackedBits> changed_rows_;
+  /// Column pairs not to separate, empty if none
+  StlBoolMatrix eager_col_pairs_;
+  /// Forbidden submatrices that can show up per column pair, empty if all
+  vector<vector<uint32_t>> reachable_codes_;
+  /// Whether every cut found for the previous model was added
+  bool prev_complete_ = false;
+  /// Codes of the forbidden submatrices up to permutation, rows sorted by value pair
+  const vector<uint32_t> forbidden_codes_;
+
+  /// Column pairs are separated in parallel over these workers
+  WorkerPool worker_pool_;
+  /// One per worker of worker_pool_
+  vector<SeparationScratch> scratch_;
+  /// Cuts added so far
+  CutPool cut_pool_;
+  /// Cuts of all cutting planes, NULL if not shared
+  SharedCutStore* shared_cuts_ = NULL;
+  /// Position in shared_cuts_ to import from next
+  size_t shared_cuts_read_ = 0;
+  /// Values of the fixed literals separateFixed is working on, instead of the model
+  const vector<lbool>* fixed_values_ = NULL;
+  /// Verbosity of the sampler, cuts are printed from 3 on
+  uint32_t verbosity_ = 1;
 };
 
 #endif // COLUMNGEN_H
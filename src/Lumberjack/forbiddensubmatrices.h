@@ -0,0 +1,162 @@
+/*
+ * forbiddensubmatrices.h
+ *
+ */
+
+#ifndef FORBIDDENSUBMATRICES_H
+#define FORBIDDENSUBMATRICES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// A 3x2 submatrix of a completion is coded in base 3, row major with the
+/// first entry most significant: "100111" is 1*243 + 0*81 + 0*27 + 1*9 + 1*3 + 1
+const uint32_t kNumSubmatrixCodes = 729;
+
+/// Submatrices that cannot appear in a 1-Dollo completion
+constexpr const char* kForbiddenSubmatrices[] = {"100111", "100112", "100211", "100212", "100121",
+                                                 "100122", "100221", "100222", "200111", "200112",
+                                                 "200211", "200212", "200121", "200122", "200221",
+                                                 "200222", "110212", "110222", "210212", "210222",
+                                                 "201121", "201122", "201221", "201222", "211222"};
+const size_t kNumForbiddenSubmatrices = sizeof(kForbiddenSubmatrices) / sizeof(kForbiddenSubmatrices[0]);
+
+/// Code of a submatrix given as a string of its entries
+constexpr uint32_t submatrixCode(const char* str, uint32_t code = 0)
+{
+  return *str == '\0' ? code : submatrixCode(str + 1, code * 3 + (*str - '0'));
+}
+
+/// Code of a submatrix given as the codes of its rows, each first entry * 3 + second entry
+constexpr uint32_t submatrixCode(uint32_t row1, uint32_t row2, uint32_t row3)
+{
+  return row1 * 81 + row2 * 9 + row3;
+}
+
+/// Word of the forbidden bitset, folding in kForbiddenSubmatrices[i] onwards
+constexpr uint64_t forbiddenSubmatrixWord(uint32_t word, size_t i = 0)
+{
+  return i == kNumForbiddenSubmatrices ? 0ULL
+    : (submatrixCode(kForbiddenSubmatrices[i]) / 64 == word ? 1ULL << (submatrixCode(kForbiddenSubmatrices[i]) % 64) : 0ULL)
+      | forbiddenSubmatrixWord(word, i + 1);
+}
+
+/// Bit c is set iff the submatrix with code c is forbidden
+constexpr uint64_t kForbiddenSubmatrixBits[(kNumSubmatrixCodes + 63) / 64] = {
+  forbiddenSubmatrixWord(0), forbiddenSubmatrixWord(1), forbiddenSubmatrixWord(2), forbiddenSubmatrixWord(3),
+  forbiddenSubmatrixWord(4), forbiddenSubmatrixWord(5), forbiddenSubmatrixWord(6), forbiddenSubmatrixWord(7),
+  forbiddenSubmatrixWord(8), forbiddenSubmatrixWord(9), forbiddenSubmatrixWord(10), forbiddenSubmatrixWord(11)};
+
+inline bool isForbiddenSubmatrix(uint32_t code)
+{
+  return (kForbiddenSubmatrixBits[code / 64] >> (code % 64)) & 1ULL;
+}
+
+/// Entries of the submatrix with the given code, row major
+inline std::vector<int> submatrixEntries(uint32_t code)
+{
+  std::vector<int> entries(6);
+  for (size_t i = 6; i-- > 0;)
+  {
+    entries[i] = code % 3;
+    code /= 3;
+  }
+  return entries;
+}
+
+inline std::string submatrixString(uint32_t code)
+{
+  std::string str;
+  for (int entry : submatrixEntries(code))
+  {
+    str += (char)('0' + entry);
+  }
+  return str;
+}
+
+/// Codes of all forbidden submatrices, in increasing order
+inline std::vector<uint32_t> forbiddenSubmatrixCodes()
+{
+  std::vector<uint32_t> codes;
+  for (uint32_t code = 0; code < kNumSubmatrixCodes; code++)
+  {
+    if (isForbiddenSubmatrix(code))
+    {
+      codes.push_back(code);
+    }
+  }
+  return codes;
+}
+
+/// Code of the submatrix with its rows reordered and its columns swapped or not
+/// @param row_order row i of the result is row row_order[i] of the input
+inline uint32_t permuteSubmatrixCode(uint32_t code, const size_t row_order[3], bool swap_cols)
+{
+  const uint32_t rows[3] = {code / 81, code / 9 % 9, code % 9};
+  uint32_t permuted[3];
+  for (size_t i = 0; i < 3; i++)
+  {
+    const uint32_t row = rows[row_order[i]];
+    permuted[i] = swap_cols ? row % 3 * 3 + row / 3 : row;
+  }
+  return submatrixCode(permuted[0], permuted[1], permuted[2]);
+}
+
+/// Is some row and column permutation of the submatrix forbidden?
+inline bool isForbiddenUpToPermutation(uint32_t code)
+{
+  static const size_t row_orders[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+  for (const auto& row_order : row_orders)
+  {
+    if (isForbiddenSubmatrix(permuteSubmatrixCode(code, row_order, false))
+        || isForbiddenSubmatrix(permuteSubmatrixCode(code, row_order, true)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Codes to forbid at rows row1 < row2 < row3 and columns col1 < col2, so
+/// that every ordering of the rows and columns is covered once
+inline std::vector<uint32_t> permutedForbiddenSubmatrixCodes()
+{
+  std::vector<uint32_t> codes;
+  for (uint32_t code = 0; code < kNumSubmatrixCodes; code++)
+  {
+    if (isForbiddenUpToPermutation(code))
+    {
+      codes.push_back(code);
+    }
+  }
+  return codes;
+}
+
+/// Code of the submatrix with its rows in increasing order of their value pairs
+inline uint32_t sortSubmatrixRows(uint32_t code)
+{
+  uint32_t rows[3] = {code / 81, code / 9 % 9, code % 9};
+  std::sort(rows, rows + 3);
+  return submatrixCode(rows[0], rows[1], rows[2]);
+}
+
+/// The codes of permutedForbiddenSubmatrixCodes whose rows are in increasing
+/// order of their value pairs. Whether three rows of a column pair form a
+/// forbidden submatrix only depends on which value pairs they have
+inline std::vector<uint32_t> sortedForbiddenSubmatrixCodes()
+{
+  std::vector<uint32_t> codes;
+  for (uint32_t code : permutedForbiddenSubmatrixCodes())
+  {
+    if (code / 81 <= code / 9 % 9 && code / 9 % 9 <= code % 9)
+    {
+      codes.push_back(code);
+    }
+  }
+  return codes;
+}
+
+#endif // FORBIDDENSUBMATRICES_H
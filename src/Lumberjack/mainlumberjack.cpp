@@ -42,6 +42,8 @@ using std::vector;
 #include "../config.h"
 #include "unigen/unigen.h"
 #include "../time_mem.h"
+#include "../samplewriter.h"
+#include "../samplefile.h"
 #include <approxmc/approxmc.h>
 #include <fstream>
 
@@ -75,7 +77,9 @@ double var_elim_ratio;
 uint32_t detach_xors = 1;
 uint32_t reuse_models = 1;
 uint32_t force_sol_extension = 0;
+uint32_t defer_sol_extension;
 uint32_t sparse;
+uint32_t num_threads = 1;
 
 // dolloSAT
 double false_negative_rate = 0.5;
@@ -84,12 +88,23 @@ int32_t num_cell_clusters = -1;
 int32_t num_mutation_clusters = -1;
 string allowed_losses = "";
 int use_cutting_plane = 1;
+uint32_t separation_threads = 1;
+uint32_t max_cuts_per_round = 0;
+int compact_encoding = 1;
+uint32_t warm_start_cuts = 1000;
+string cut_cache_file;
+int separate_fixed = 0;
 
 //sampling
 uint32_t num_samples = 20;
 int only_indep_samples ;
 int multisample;
+int reservoir;
+int sparse_sampling;
+int rebuild_solver = 1;
+uint32_t sink_queue;
 std::string sample_fname;
+std::string sample_bin_fname;
 double kappa;      /* Corresponds to epsilon=16 */
 bool verb_sampler_cls ;
 
@@ -113,8 +128,14 @@ void add_UniGen_options()
     UniG tmp2(NULL);
     kappa = tmp2.get_kappa();
     multisample = tmp2.get_multisample();
-    only_indep_samples = tmp2.get_only_indep_samples();
+    reservoir = tmp2.get_reservoir();
+    sparse_sampling = tmp2.get_sparse_sampling();
+    sink_queue = tmp2.get_sink_queue();
+    // the sampling set is only the loss and fp/fn variables, printing a
+    // sample needs the duplicate variables too
+    only_indep_samples = false;
     force_sol_extension = tmp2.get_force_sol_extension();
+    defer_sol_extension = tmp2.get_defer_sol_extension();
     verb_sampler_cls = tmp2. get_verb_sampler_cls();
 
     std::ostringstream my_epsilon;
@@ -145,7 +166,19 @@ void add_UniGen_options()
     ("allowed_losses,l", po::value(&allowed_losses),
         "Mutations that are allowed to be lost, zero indexed, comma separated (ex: 0,1,4)")
     ("use_cuts", po::value(&use_cutting_plane)->default_value(use_cutting_plane),
-        "Use cutting plane (0 for no, 1 for yes)")
+        "Forbidden submatrices: 0 all clauses up front, 1 cutting plane, 2 clauses for conflicting column pairs and cutting plane for the rest, 3 pick from the instance size. Options of a strategy not in use are ignored with a warning")
+    ("septhreads", po::value(&separation_threads)->default_value(separation_threads),
+        "Number of threads the cutting plane separates with")
+    ("maxcuts", po::value(&max_cuts_per_round)->default_value(max_cuts_per_round),
+        "Most cuts added per model found, the most violated first (0 for no limit)")
+    ("compact_eager", po::value(&compact_encoding)->default_value(compact_encoding),
+        "Without cuts, forbid submatrices per column pair pattern, in O(mn^2) clauses (0 for no, 1 for yes)")
+    ("warmcuts", po::value(&warm_start_cuts)->default_value(warm_start_cuts),
+        "With cuts, most submatrices to forbid up front, those B shows or one changed entry away first")
+    ("cutcache", po::value(&cut_cache_file),
+        "With cuts, file to keep the cuts found for this instance in and to add them from in later runs")
+    ("fixedcuts", po::value(&separate_fixed)->default_value(separate_fixed),
+        "With cuts, also separate what the solver fixed at level 0 before every solve, not only full models (0 for no, 1 for yes)")
     
 
     ("epsilon", po::value(&epsilon)->default_value(epsilon, my_epsilon.str())
@@ -159,12 +192,16 @@ void add_UniGen_options()
     improvement_options.add_options()
     ("sparse", po::value(&sparse)->default_value(sparse)
         , "Generate sparse XORs when possible")
+    ("sparsesampling", po::value(&sparse_sampling)->default_value(sparse_sampling)
+        , "With --sparse, also sample with sparse XORs. Faster, but the samples are no longer guaranteed to be almost-uniform")
     ("detachxor", po::value(&detach_xors)->default_value(detach_xors)
         , "Detach XORs in CMS")
     ("reusemodels", po::value(&reuse_models)->default_value(reuse_models)
         , "Reuse models while counting solutions")
     ("forcesolextension", po::value(&force_sol_extension)->default_value(force_sol_extension)
         , "Use trick of not extending solutions in the SAT solver to full solution")
+    ("defersolext", po::value(&defer_sol_extension)->default_value(defer_sol_extension)
+        , "Solve on the sampling set only and extend just the output samples. 0 = off, 1 = extend on the sampling solver, 2 = extend on a copy of it")
     ;
 
     misc_options.add_options()
@@ -180,15 +217,25 @@ void add_UniGen_options()
     ("samples", po::value(&num_samples)->default_value(num_samples)
         , "Number of random samples to generate")
     ("nosolext", po::value(&only_indep_samples)->default_value(only_indep_samples)
-        , "Should only output the independent vars from the samples")
+        , "Should only output the independent vars (loss, fp and fn) from the samples, which cannot be printed as matrices")
     ("multisample", po::value(&multisample)->default_value(multisample)
         , "Return multiple samples from each call")
     ("sampleout", po::value(&sample_fname)
         , "Write samples to this file")
+    ("samplebin", po::value(&sample_bin_fname)
+        , "Write samples bit-packed to this binary file instead of as text, see samplefile.h")
     ("kappa", po::value(&kappa)->default_value(kappa, my_kappa.str())
         , "Uniformity parameter (see TACAS-15 paper)")
     ("verbsamplercls", po::value(&verb_sampler_cls)->default_value(verb_sampler_cls)
         , "Print XOR constraints added for sampling")
+    ("reservoir", po::value(&reservoir)->default_value(reservoir)
+        , "When all solutions are enumerated, keep only a reservoir of the samples")
+    ("samplequeue", po::value(&sink_queue)->default_value(sink_queue)
+        , "Write samples from a separate thread, sampling waits while this many are queued. 0 writes them directly")
+    ("threads", po::value(&num_threads)->default_value(num_threads)
+        , "Number of threads to sample with, each with its own solver")
+    ("rebuild", po::value(&rebuild_solver)->default_value(rebuild_solver)
+        , "Rebuild the sampling solver from the input formula from time to time, to drop retired hash and banning variables. Keeps a copy of the formula, as do --threads above 1 and --defersolext 2, which doubles the memory the formula takes")
     ;
 
     help_options.add(main_options);
@@ -366,13 +413,32 @@ void read_stdin()
     #endif
 }
 
-void mycallback(const std::vector<int>& solution, void *file)
+bool option_given(const char* name)
 {
-    std::ostream* os = (std::ostream*)file;
-    for(uint32_t i = 0; i < solution.size(); i++) {
-        (*os) << solution[i] <<  " ";
+    return vm.count(name) != 0 && !vm[name].defaulted();
+}
+
+//Only warns about options given on the command line, the defaults of the
+//cut options are on but mean nothing without cuts
+void warn_ignored_options(const CutStrategy strategy)
+{
+    const char* const cut_options[] = {"warmcuts", "cutcache", "fixedcuts"};
+    if (strategy == CutStrategy::Eager) {
+        for (const char* name: cut_options) {
+            if (option_given(name)) {
+                cout << "Warning: eager strategy chosen, no cuts, --"
+                << name << " has no effect" << endl;
+            }
+        }
+    } else if (option_given("compact_eager")) {
+        cout << "Warning: --compact_eager only applies to the eager strategy,"
+        << " it has no effect" << endl;
     }
-    (*os) << "0" << endl;
+}
+
+void mycallback(const std::vector<int>& solution, void *writer)
+{
+    ((SampleWriter*)writer)->write_sample(solution);
 }
 
 int main(int argc, char** argv)
@@ -396,6 +462,8 @@ int main(int argc, char** argv)
     appmc = new ApproxMC::AppMC;
     unigen = new UniG(appmc);
     add_supported_options(argc, argv);
+    unigen->set_record_input(
+        num_threads > 1 || defer_sol_extension == 2 || rebuild_solver);
     if (verbosity) {
         cout << unigen->get_version_info();
         cout << "c executed with command line: " << command_line << endl;
@@ -471,10 +539,22 @@ int main(int argc, char** argv)
         allowed_losses_ptr = &allowed_losses_set;
     }
 
-    bool use_cuts = (use_cutting_plane == 1);
+    CutStrategy strategy;
+    switch (use_cutting_plane) {
+        case 0: strategy = CutStrategy::Eager; break;
+        case 1: strategy = CutStrategy::Lazy; break;
+        case 2: strategy = CutStrategy::Hybrid; break;
+        case 3: strategy = CutStrategy::Auto; break;
+        default:
+            cerr << "ERROR: Invalid value '" << use_cutting_plane << "'" << endl
+            << "       given to option 'use_cuts', it must be 0, 1, 2 or 3" << endl;
+            std::exit(-1);
+    }
 
-    SamplerDollo sampler(D, 2, appmc, unigen, num_cell_clusters, num_mutation_clusters, false_positive_rate, false_negative_rate, allowed_losses_ptr, use_cuts);
+    SamplerDollo sampler(D, 2, appmc, unigen, num_cell_clusters, num_mutation_clusters, false_positive_rate, false_negative_rate, allowed_losses_ptr, strategy, separation_threads, max_cuts_per_round, compact_encoding == 1, warm_start_cuts, cut_cache_file, separate_fixed == 1);
+    sampler.SetVerbosity(verbosity);
     sampler.Init();
+    warn_ignored_options(sampler.GetCutStrategy());
 
     std::cout << "After reading input matrix:\n";
 
@@ -496,6 +576,11 @@ int main(int argc, char** argv)
     unigen->set_multisample(multisample);
     unigen->set_only_indep_samples(only_indep_samples);
     unigen->set_force_sol_extension(force_sol_extension);
+    unigen->set_defer_sol_extension(defer_sol_extension);
+    unigen->set_num_threads(num_threads);
+    unigen->set_reservoir(reservoir);
+    unigen->set_sparse_sampling(sparse_sampling);
+    unigen->set_sink_queue(sink_queue);
     std::cout << "After other stuff:\n";
 
     std::ofstream logfile;
@@ -523,9 +608,24 @@ int main(int argc, char** argv)
         myfile = &sample_out;
     }
 
-    unigen->set_callback(mycallback, myfile);
+    SampleWriter sample_writer((std::ostream*)myfile);
+    unigen->set_callback(mycallback, &sample_writer);
+    SampleFileWriter* sample_bin = NULL;
+    if (vm.count("samplebin") != 0) {
+        sample_bin = new SampleFileWriter(sample_bin_fname, seed);
+        if (!sample_bin->is_open()) {
+            cout << "[Sampler] Cannot open binary samples file '" << sample_bin_fname
+                 << "' for writing." << endl;
+            exit(-1);
+        }
+        unigen->set_packed_callback(
+            SampleFileWriter::add_sample, SampleFileWriter::setup, sample_bin);
+    }
     // END HERE
     sampler.Sample(&sol_count, num_samples, out_filename);
+    sample_writer.finish();
+    sampler.SaveCutCache();
+    delete sample_bin;
 
     delete unigen;
     delete appmc;
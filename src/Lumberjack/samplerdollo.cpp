@@ -1,7 +1,9 @@
 #include "samplerdollo.h"
 #include "cuttingplanedollo.h"
+#include "forbiddensubmatrices.h"
 #include "adder.h"
 #include <map>
+#include <algorithm>
 
 using std::map;
 using std::vector;
@@ -10,7 +12,13 @@ SamplerDollo::SamplerDollo(const Matrix &B, size_t k, AppMC *appmc, UniG *unigen
                            size_t cell_clusters, size_t mutation_clusters,
                            double false_pos_rate, double false_neg_rate,
                            const unordered_set<size_t> *allowed_losses,
-                           bool use_cutting_plane)
+                           CutStrategy strategy,
+                           size_t separation_threads,
+                           size_t max_cuts_per_round,
+                           bool compact_encoding,
+                           size_t warm_start_cuts,
+                           const string &cut_cache_file,
+                           bool separate_fixed)
     : B_(B),
       m_(B.getNrClones()),
       n_(B.getNrMutations()),
@@ -27,18 +35,55 @@ SamplerDollo::SamplerDollo(const Matrix &B, size_t k, AppMC *appmc, UniG *unigen
       num_cell_clusters_(cell_clusters),
       num_mutation_clusters_(mutation_clusters),
       allowed_losses_(allowed_losses),
-      use_cutting_plane_(use_cutting_plane)
+      strategy_(strategy),
+      use_cutting_plane_(strategy != CutStrategy::Eager),
+      separation_threads_(separation_threads),
+      max_cuts_per_round_(max_cuts_per_round),
+      compact_encoding_(compact_encoding),
+      warm_start_cuts_(warm_start_cuts),
+      cut_cache_file_(cut_cache_file),
+      separate_fixed_(separate_fixed)
 {
 }
 
 void SamplerDollo::Init()
 {
+  InitializeErrorBudgets();
+  InitializeReachableCodes();
+
+  if (strategy_ == CutStrategy::Auto) {
+    strategy_ = ChooseCutStrategy();
+  }
+  else if (strategy_ != CutStrategy::Lazy) {
+    // all column pairs for eager, only the conflicting ones for a hybrid
+    eager_col_pairs_.assign(n_, StlBoolVector(n_, false));
+    for (size_t col1 = 0; col1 < n_; col1++) {
+      for (size_t col2 = col1 + 1; col2 < n_; col2++) {
+        eager_col_pairs_[col1][col2] = reachable_codes_[col1][col2] != 0
+          && (strategy_ == CutStrategy::Eager || IsConflictingColPair(col1, col2));
+      }
+    }
+  }
+  use_cutting_plane_ = strategy_ != CutStrategy::Eager;
+
   InitializeVariableMatrices();
+  if (strategy_ == CutStrategy::Hybrid || (strategy_ == CutStrategy::Eager && compact_encoding_)) {
+    InitializePatternVariables();
+  }
   PrintVariableMatrices();
 
   if (use_cutting_plane_) {
-    cutting_plane_ = new CuttingPlaneDollo(approxmc_->get_solver(), B_, loss_vars_, false_neg_vars_, false_pos_vars_, row_is_duplicate_, col_is_duplicate_);
+    cutting_plane_ = new CuttingPlaneDollo(approxmc_->get_solver(), B_, loss_vars_, false_neg_vars_, false_pos_vars_, row_is_duplicate_, col_is_duplicate_, separation_threads_, max_cuts_per_round_);
+    cutting_plane_->setEagerColumnPairs(eager_col_pairs_);
+    cutting_plane_->setReachableCodes(reachable_codes_);
+    cutting_plane_->setSharedCuts(&shared_cuts_);
+    cutting_plane_->setVerbosity(verbosity_);
     unigen_->set_cutting_plane(cutting_plane_);
+    unigen_->set_cutting_plane_factory(&SamplerDollo::CreateWorkerCuttingPlane, this);
+    unigen_->set_cutting_plane_rebinder(&SamplerDollo::RebindCuttingPlane, this);
+    if (separate_fixed_) {
+      unigen_->set_fixed_separator(&SamplerDollo::SeparateFixed, this);
+    }
     approxmc_->setCuttingPlane(cutting_plane_);
   }
 
@@ -49,9 +94,13 @@ void SamplerDollo::Init()
   UpdateSamplingSet();
 
   vector<Lit> tmp{Lit(0, false)};
-  approxmc_->add_clause(tmp);
+  unigen_->add_clause(tmp);
 
-  if (!use_cutting_plane_) {
+  if (strategy_ == CutStrategy::Hybrid || (strategy_ == CutStrategy::Eager && compact_encoding_)) {
+    std::cout << "Adding pattern clauses\n";
+    AddPatternClauses();
+  }
+  else if (strategy_ == CutStrategy::Eager) {
     std::cout << "Adding cutting plane clauses\n";
     AddCuttingPlaneClauses();
   }
@@ -73,10 +122,161 @@ void SamplerDollo::Init()
   std::cout << "Adding unsupported losses clauses\n";
   AddUnsupportedLossesClauses();
 
+  if (use_cutting_plane_ && warm_start_cuts_ > 0) {
+    std::cout << "Adding warm start clauses\n";
+    AddWarmStartClauses();
+  }
+
+  if (use_cutting_plane_ && !cut_cache_file_.empty()) {
+    std::cout << "Adding cached cuts\n";
+    LoadCutCache();
+  }
+
   for (auto clause : adder_clauses)
   {
-    approxmc_->add_clause(clause);
+    unigen_->add_clause(clause);
+  }
+}
+
+CutStrategy SamplerDollo::ChooseCutStrategy()
+{
+  // most clauses the forbidden submatrices may add up front
+  const double max_eager_clauses = 1 << 23;
+
+  const double m = m_;
+  const double n = n_;
+  const double col_pairs = n * (n - 1) / 2;
+
+  // variables and clauses of everything but the forbidden submatrices:
+  // entries, clustering and duplicates, then the binary adders of the error
+  // budgets, about two variables and 14 clauses per fp or fn variable
+  const double base_vars = 2 * m * n + m * col_pairs + n * m * (m - 1) / 2
+    + m * (m - 1) / 2 + col_pairs + m + n
+    + 2 * m * n;
+  const double base_clauses = 2 * m * n + 9 * (m * col_pairs + n * m * (m - 1) / 2)
+    + 3 * (n * m * (m - 1) / 2 + m * col_pairs) + m + n
+    + 14 * m * n;
+
+  size_t num_forbidden_rows = 0;
+  vector<bool> is_forbidden_row(9, false);
+  for (uint32_t code : sortedForbiddenSubmatrixCodes())
+  {
+    for (uint32_t row : {code / 81, code / 9 % 9, code % 9})
+    {
+      if (!is_forbidden_row[row])
+      {
+        is_forbidden_row[row] = true;
+        num_forbidden_rows++;
+      }
+    }
+  }
+  const double num_sorted_codes = sortedForbiddenSubmatrixCodes().size();
+  const double num_permuted_codes = permutedForbiddenSubmatrixCodes().size();
+
+  // compact encoding of one column pair: a variable per row and pattern,
+  // defined in up to 7 clauses, and a clause per forbidden submatrix
+  const double pair_vars = num_forbidden_rows * (m + 1);
+  const double pair_clauses = num_forbidden_rows * (7 * m + 1) + num_sorted_codes;
+
+  // column pairs where some forbidden submatrix can show up
+  StlBoolMatrix reachable_col_pairs(n_, StlBoolVector(n_, false));
+  size_t num_reachable = 0;
+  for (size_t col1 = 0; col1 < n_; col1++)
+  {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++)
+    {
+      if (reachable_codes_[col1][col2] != 0)
+      {
+        reachable_col_pairs[col1][col2] = true;
+        num_reachable++;
+      }
+    }
+  }
+
+  double eager_vars = 0;
+  double eager_clauses = 0;
+  if (compact_encoding_)
+  {
+    eager_vars = num_reachable * pair_vars;
+    eager_clauses = num_reachable * pair_clauses;
+  }
+  else
+  {
+    eager_clauses = m * (m - 1) * (m - 2) / 6 * num_reachable * num_permuted_codes;
+  }
+
+  StlBoolMatrix conflicting_col_pairs(n_, StlBoolVector(n_, false));
+  size_t num_conflicting = 0;
+  for (size_t col1 = 0; col1 < n_; col1++)
+  {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++)
+    {
+      if (reachable_col_pairs[col1][col2] && IsConflictingColPair(col1, col2))
+      {
+        conflicting_col_pairs[col1][col2] = true;
+        num_conflicting++;
+      }
+    }
+  }
+  const double hybrid_vars = num_conflicting * pair_vars;
+  const double hybrid_clauses = num_conflicting * pair_clauses;
+
+  // words read by a full separation: a row bitset per value pair of both
+  // columns, then one per row of each forbidden submatrix
+  const double words = ceil(m / 64);
+  const double scan_words = num_reachable * words * (9 + 3 * num_sorted_codes);
+
+  std::cout << "Estimated size of " << m_ << "x" << n_ << " instance, "
+            << num_cell_clusters_ << " cell and " << num_mutation_clusters_ << " mutation clusters, fp rate "
+            << fp_rate_ << ", fn rate " << fn_rate_ << ":\n"
+            << "  without forbidden submatrices: " << base_vars << " vars, " << base_clauses << " clauses\n"
+            << "  " << num_reachable << " of " << col_pairs << " column pairs can have a forbidden submatrix\n"
+            << "  eager" << (compact_encoding_ ? " (compact)" : "") << ": +" << eager_vars << " vars, +"
+            << eager_clauses << " clauses\n"
+            << "  hybrid, " << num_conflicting << " of them conflicting: +"
+            << hybrid_vars << " vars, +" << hybrid_clauses << " clauses\n"
+            << "  lazy: " << scan_words << " words read per full separation\n";
+
+  CutStrategy strategy;
+  if (eager_clauses <= max_eager_clauses)
+  {
+    // separating every model costs more than the clauses
+    std::cout << "Choosing eager: all clauses fit in " << max_eager_clauses << "\n";
+    strategy = CutStrategy::Eager;
+    eager_col_pairs_ = reachable_col_pairs;
+  }
+  else if (num_conflicting > 0 && hybrid_clauses <= max_eager_clauses)
+  {
+    std::cout << "Choosing hybrid: clauses of the conflicting column pairs fit in " << max_eager_clauses
+              << ", the other " << num_reachable - num_conflicting << " are separated\n";
+    strategy = CutStrategy::Hybrid;
+    eager_col_pairs_ = conflicting_col_pairs;
+  }
+  else
+  {
+    std::cout << "Choosing lazy: "
+              << (num_conflicting > 0 ? "clauses of the conflicting column pairs do not fit in "
+                                      : "no column pair conflicts and all clauses do not fit in ")
+              << max_eager_clauses << "\n";
+    strategy = CutStrategy::Lazy;
   }
+  return strategy;
+}
+
+bool SamplerDollo::IsConflictingColPair(size_t col1, size_t col2) const
+{
+  bool has_01 = false;
+  bool has_10 = false;
+  bool has_11 = false;
+  for (size_t row = 0; row < m_; row++)
+  {
+    int entry1 = B_.getEntry(row, col1);
+    int entry2 = B_.getEntry(row, col2);
+    has_01 |= entry1 == 0 && entry2 == 1;
+    has_10 |= entry1 == 1 && entry2 == 0;
+    has_11 |= entry1 == 1 && entry2 == 1;
+  }
+  return has_01 && has_10 && has_11;
 }
 
 void SamplerDollo::Sample(const ApproxMC::SolCount *sol_count, uint32_t num_samples, string *out_filename)
@@ -94,19 +294,40 @@ void SamplerDollo::Sample(const ApproxMC::SolCount *sol_count, uint32_t num_samp
   }
 }
 
+CuttingPlane* SamplerDollo::CreateWorkerCuttingPlane(SATSolver *solver, void *data)
+{
+  SamplerDollo *sampler = static_cast<SamplerDollo *>(data);
+  CuttingPlaneDollo *cutting_plane = new CuttingPlaneDollo(solver, sampler->B_, sampler->loss_vars_, sampler->false_neg_vars_, sampler->false_pos_vars_, sampler->row_is_duplicate_, sampler->col_is_duplicate_, sampler->separation_threads_, sampler->max_cuts_per_round_);
+  cutting_plane->setEagerColumnPairs(sampler->eager_col_pairs_);
+  cutting_plane->setReachableCodes(sampler->reachable_codes_);
+  cutting_plane->setSharedCuts(&sampler->shared_cuts_);
+  cutting_plane->setVerbosity(sampler->verbosity_);
+  sampler->worker_cutting_planes_.emplace_back(cutting_plane);
+  return cutting_plane;
+}
+
+void SamplerDollo::RebindCuttingPlane(CuttingPlane *cutting_plane, SATSolver *solver, void *)
+{
+  static_cast<CuttingPlaneDollo *>(cutting_plane)->setSolver(solver);
+}
+
 void SamplerDollo::PrintSolutions(const vector<vector<int>> &solutions, std::ostream &os) const
 {
-  os << solutions.size() << " solutions sampled\n";
+  // formatting stays on this thread, the writes go to the writer's
+  SampleWriter writer(&os);
+  writer.write_int(solutions.size());
+  writer.write(" solutions sampled\n", 19);
 
-  for (auto solution : solutions)
+  for (const auto &solution : solutions)
   {
-    os << "===================\n";
+    writer.write("===================\n", 20);
     map<int, bool> sol_map = GetSolutionMap(solution);
     vector<vector<int>> sol_matrix = GetSolMatrix(sol_map);
 
     ValidateSolution(sol_map, sol_matrix);
-    PrintClusteredMatrix(sol_map, sol_matrix, os);
+    PrintClusteredMatrix(sol_map, sol_matrix, writer);
   }
+  writer.finish();
 }
 
 void SamplerDollo::InitializeVariableMatrices()
@@ -204,6 +425,186 @@ void SamplerDollo::InitializeVariableMatrices()
   UpdateIndependentSet();
 }
 
+void SamplerDollo::InitializePatternVariables()
+{
+  const vector<uint32_t> forbidden_codes = sortedForbiddenSubmatrixCodes();
+
+  col_pair_shows_pattern_.resize(n_);
+  row_shows_pattern_.resize(n_);
+  for (size_t i = 0; i < n_; i++)
+  {
+    col_pair_shows_pattern_[i].resize(n_);
+    row_shows_pattern_[i].resize(n_);
+
+    for (size_t j = i + 1; j < n_; j++)
+    {
+      if (!eager_col_pairs_[i][j])
+      {
+        continue;
+      }
+
+      // value pairs that are a row of some reachable forbidden submatrix
+      vector<bool> is_forbidden_row(9, false);
+      for (size_t k = 0; k < forbidden_codes.size(); k++)
+      {
+        if ((reachable_codes_[i][j] >> k) & 1)
+        {
+          is_forbidden_row[forbidden_codes[k] / 81] = true;
+          is_forbidden_row[forbidden_codes[k] / 9 % 9] = true;
+          is_forbidden_row[forbidden_codes[k] % 9] = true;
+        }
+      }
+
+      col_pair_shows_pattern_[i][j].resize(9);
+      row_shows_pattern_[i][j].resize(9);
+
+      for (size_t p = 0; p < 9; p++)
+      {
+        if (!is_forbidden_row[p])
+        {
+          continue;
+        }
+        col_pair_shows_pattern_[i][j][p] = GetNewVar();
+        row_shows_pattern_[i][j][p].resize(m_);
+        for (size_t k = 0; k < m_; k++)
+        {
+          row_shows_pattern_[i][j][p][k] = GetNewVar();
+        }
+      }
+    }
+  }
+}
+
+void SamplerDollo::InitializeErrorBudgets()
+{
+  size_t num_zeros = 0;
+  size_t num_ones = 0;
+  for (size_t i = 0; i < m_; i++)
+  {
+    for (size_t j = 0; j < n_; j++)
+    {
+      if (B_.getEntry(i, j) == 1)
+      {
+        num_ones++;
+      }
+      else
+      {
+        num_zeros++;
+      }
+    }
+  }
+  num_fn_ = ceil(fn_rate_ * num_zeros);
+  num_fp_ = ceil(fp_rate_ * num_ones);
+}
+
+void SamplerDollo::InitializeReachableCodes()
+{
+  const vector<uint32_t> forbidden_codes = sortedForbiddenSubmatrixCodes();
+
+  reachable_codes_.assign(n_, vector<uint32_t>(n_, 0));
+  size_t num_reachable = 0;
+  for (size_t col1 = 0; col1 < n_; col1++)
+  {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++)
+    {
+      // the value pairs a row can take only depend on its entries in B
+      size_t num_rows[4] = {0, 0, 0, 0};
+      for (size_t row = 0; row < m_; row++)
+      {
+        num_rows[(B_.getEntry(row, col1) == 1) * 2 + (B_.getEntry(row, col2) == 1)]++;
+      }
+      uint32_t row_value_pairs[4];
+      for (size_t entries = 0; entries < 4; entries++)
+      {
+        row_value_pairs[entries] = GetReachableValuePairs(entries / 2, entries % 2, col1, col2);
+      }
+
+      for (size_t k = 0; k < forbidden_codes.size(); k++)
+      {
+        // the value pairs of a forbidden submatrix are all different, so it
+        // can show up iff they can be given to three different rows: every
+        // subset of them is reachable in at least as many rows as it has
+        const uint32_t pairs[3] = {forbidden_codes[k] / 81, forbidden_codes[k] / 9 % 9, forbidden_codes[k] % 9};
+        bool reachable = true;
+        for (uint32_t subset = 1; subset < 8 && reachable; subset++)
+        {
+          uint32_t subset_pairs = 0;
+          for (size_t p = 0; p < 3; p++)
+          {
+            if ((subset >> p) & 1)
+            {
+              subset_pairs |= 1U << pairs[p];
+            }
+          }
+          size_t rows = 0;
+          for (size_t entries = 0; entries < 4; entries++)
+          {
+            if (row_value_pairs[entries] & subset_pairs)
+            {
+              rows += num_rows[entries];
+            }
+          }
+          reachable = rows >= (size_t)popcount64(subset);
+        }
+        if (reachable)
+        {
+          reachable_codes_[col1][col2] |= 1U << k;
+        }
+      }
+      if (reachable_codes_[col1][col2] != 0)
+      {
+        num_reachable++;
+      }
+    }
+  }
+  std::cout << "Forbidden submatrices reachable in " << num_reachable << " of "
+            << n_ * (n_ - 1) / 2 << " column pairs" << std::endl;
+}
+
+uint32_t SamplerDollo::GetReachableValuePairs(int entry1, int entry2, size_t col1, size_t col2) const
+{
+  // false negatives and false positives each value of an entry needs: a 0
+  // becomes 1 through a false negative, a 1 becomes 0 or is lost through a
+  // false positive
+  const int entries[2] = {entry1, entry2};
+  const size_t cols[2] = {col1, col2};
+  size_t fn_needed[2][3];
+  size_t fp_needed[2][3];
+  for (size_t i = 0; i < 2; i++)
+  {
+    const bool is_one = entries[i] == 1;
+    fn_needed[i][0] = 0;
+    fn_needed[i][1] = is_one ? 0 : 1;
+    fn_needed[i][2] = 0;
+    fp_needed[i][0] = is_one ? 1 : 0;
+    fp_needed[i][1] = 0;
+    fp_needed[i][2] = is_one ? 1 : 0;
+  }
+
+  uint32_t value_pairs = 0;
+  for (size_t a = 0; a < 3; a++)
+  {
+    for (size_t b = 0; b < 3; b++)
+    {
+      if ((a == 2 && IsLossForbidden(cols[0])) || (b == 2 && IsLossForbidden(cols[1])))
+      {
+        continue;
+      }
+      if (fn_needed[0][a] + fn_needed[1][b] <= num_fn_
+          && fp_needed[0][a] + fp_needed[1][b] <= num_fp_)
+      {
+        value_pairs |= 1U << (a * 3 + b);
+      }
+    }
+  }
+  return value_pairs;
+}
+
+bool SamplerDollo::IsLossForbidden(size_t col) const
+{
+  return allowed_losses_ != nullptr && allowed_losses_->find(col) == allowed_losses_->end();
+}
+
 Adder SamplerDollo::GetAdder()
 {
   Adder adder(num_vars_);
@@ -222,7 +623,6 @@ Adder SamplerDollo::GetAdder()
   }
   if (false_neg_flattened.size() > 0)
   {
-    num_fn_ = ceil(fn_rate_ * false_neg_flattened.size());
     std::cout << "Max num false negatives: " << num_fn_ << std::endl;
     adder.EncodeLeqToK(false_neg_flattened, num_fn_);
   }
@@ -241,7 +641,6 @@ Adder SamplerDollo::GetAdder()
   }
   if (false_pos_flattened.size() > 0)
   {
-    num_fp_ = ceil(fp_rate_ * false_pos_flattened.size());
     std::cout << "Max num false positives: " << num_fp_ << std::endl;
     adder.EncodeLeqToK(false_pos_flattened, num_fp_);
   }
@@ -434,7 +833,7 @@ void SamplerDollo::AddUnsupportedLossesClauses()
   {
     for (size_t mutation_idx = 0; mutation_idx < n_; mutation_idx++)
     {
-      if (allowed_losses_->find(mutation_idx) != allowed_losses_->end())
+      if (IsLossForbidden(mutation_idx))
       {
         for (size_t i = 0; i < m_; i++)
         {
@@ -449,32 +848,30 @@ void SamplerDollo::AddUnsupportedLossesClauses()
 
 void SamplerDollo::AddCuttingPlaneClauses()
 {
+  // each set of three rows and two columns is visited once, in increasing
+  // order, with every ordering of the forbidden submatrices
   vector<vector<int>> flattened_forbidden_submatrices;
-  for (auto submatrix : forbidden_submatrices_)
+  // bit of reachable_codes_ of each of them
+  vector<uint32_t> reachable_bits;
+  const vector<uint32_t> sorted_codes = sortedForbiddenSubmatrixCodes();
+  for (uint32_t code : permutedForbiddenSubmatrixCodes())
   {
-    vector<int> flattened_forbidden_submatrix = GetForbiddenSubmatrixFromString(submatrix);
-    flattened_forbidden_submatrices.push_back(flattened_forbidden_submatrix);
+    flattened_forbidden_submatrices.push_back(submatrixEntries(code));
+    size_t k = std::find(sorted_codes.begin(), sorted_codes.end(), sortSubmatrixRows(code)) - sorted_codes.begin();
+    reachable_bits.push_back(1U << k);
   }
 
   for (size_t row1 = 0; row1 < m_; row1++)
   {
-    for (size_t row2 = 0; row2 < m_; row2++)
+    for (size_t row2 = row1 + 1; row2 < m_; row2++)
     {
-      if (row1 == row2)
-      {
-        continue;
-      }
-      for (size_t row3 = 0; row3 < m_; row3++)
+      for (size_t row3 = row2 + 1; row3 < m_; row3++)
       {
-        if (row3 == row2 || row3 == row1)
-        {
-          continue;
-        }
         for (size_t col1 = 0; col1 < n_; col1++)
         {
-          for (size_t col2 = 0; col2 < n_; col2++)
+          for (size_t col2 = col1 + 1; col2 < n_; col2++)
           {
-            if (col1 == col2)
+            if (!eager_col_pairs_[col1][col2])
             {
               continue;
             }
@@ -495,17 +892,302 @@ void SamplerDollo::AddCuttingPlaneClauses()
             vector<int> is_one_vars = GetSubmatrixVars(positions, 1);
             vector<int> is_two_vars = GetSubmatrixVars(positions, 2);
 
-            for (auto flattened_submatrix : flattened_forbidden_submatrices)
+            for (size_t i = 0; i < flattened_forbidden_submatrices.size(); i++)
+            {
+              if (reachable_codes_[col1][col2] & reachable_bits[i])
+              {
+                AddForbiddenSubmatrixClause(flattened_forbidden_submatrices[i], is_one_vars, is_two_vars, rows, cols);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void SamplerDollo::AddPatternClauses()
+{
+  for (size_t col1 = 0; col1 < n_; col1++)
+  {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++)
+    {
+      if (!eager_col_pairs_[col1][col2])
+      {
+        continue;
+      }
+      for (size_t pattern = 0; pattern < 9; pattern++)
+      {
+        if (row_shows_pattern_[col1][col2][pattern].empty())
+        {
+          continue;
+        }
+        int col_pair_shows_pattern = col_pair_shows_pattern_[col1][col2][pattern];
+
+        // col_pair_shows_pattern => some row shows pattern
+        vector<int> some_row_clause{-col_pair_shows_pattern};
+
+        for (size_t row = 0; row < m_; row++)
+        {
+          int row_shows_pattern = row_shows_pattern_[col1][col2][pattern][row];
+
+          vector<int> shows_pattern = GetEntryValueVars(row, col1, pattern / 3);
+          vector<int> col2_value = GetEntryValueVars(row, col2, pattern % 3);
+          shows_pattern.insert(shows_pattern.end(), col2_value.begin(), col2_value.end());
+          shows_pattern.push_back(-row_is_duplicate_[row]);
+
+          // row_shows_pattern <=> row not duplicate and entries match pattern
+          AddImplyClause(shows_pattern, row_shows_pattern);
+          AddImplyClauses(vector<int>{row_shows_pattern}, shows_pattern);
+
+          // row_shows_pattern => col_pair_shows_pattern
+          AddImplyClause(vector<int>{row_shows_pattern}, col_pair_shows_pattern);
+
+          some_row_clause.push_back(row_shows_pattern);
+        }
+        AddClause(some_row_clause);
+      }
+
+      // rows with three different value pairs of a forbidden submatrix are
+      // three different rows, no need to check which
+      const vector<uint32_t> forbidden_codes = sortedForbiddenSubmatrixCodes();
+      for (size_t k = 0; k < forbidden_codes.size(); k++)
+      {
+        if (!((reachable_codes_[col1][col2] >> k) & 1))
+        {
+          continue;
+        }
+        const uint32_t code = forbidden_codes[k];
+        vector<int> clause{-col_pair_shows_pattern_[col1][col2][code / 81],
+                           -col_pair_shows_pattern_[col1][col2][code / 9 % 9],
+                           -col_pair_shows_pattern_[col1][col2][code % 9],
+                           col_is_duplicate_[col1],
+                           col_is_duplicate_[col2]};
+        AddClause(clause);
+      }
+    }
+  }
+}
+
+void SamplerDollo::AddWarmStartClauses()
+{
+  const vector<uint32_t> forbidden_codes = sortedForbiddenSubmatrixCodes();
+
+  // column pairs the cutting plane separates
+  vector<pair<size_t, size_t>> col_pairs;
+  for (size_t col1 = 0; col1 < n_; col1++)
+  {
+    for (size_t col2 = col1 + 1; col2 < n_; col2++)
+    {
+      if (reachable_codes_[col1][col2] != 0 && (eager_col_pairs_.empty() || !eager_col_pairs_[col1][col2]))
+      {
+        col_pairs.emplace_back(col1, col2);
+      }
+    }
+  }
+
+  size_t num_added = 0;
+  for (size_t changes = 0; changes <= 1 && num_added < warm_start_cuts_; changes++)
+  {
+    // every column pair gets an even share of what is left, at least one
+    const size_t left = warm_start_cuts_ - num_added;
+    const size_t per_col_pair = col_pairs.empty() ? 0 : std::max<size_t>(1, left / col_pairs.size());
+
+    size_t num_added_now = 0;
+    for (auto col_pair : col_pairs)
+    {
+      const size_t col1 = col_pair.first;
+      const size_t col2 = col_pair.second;
+
+      // rows_by_changes[c][v] holds the rows that take value pair v with c
+      // entries different from B
+      vector<vector<size_t>> rows_by_changes[2];
+      rows_by_changes[0].resize(9);
+      rows_by_changes[1].resize(9);
+      for (size_t row = 0; row < m_; row++)
+      {
+        const int entry1 = B_.getEntry(row, col1) == 1;
+        const int entry2 = B_.getEntry(row, col2) == 1;
+        const uint32_t value_pairs = GetReachableValuePairs(entry1, entry2, col1, col2);
+        for (int a = 0; a < 3; a++)
+        {
+          for (int b = 0; b < 3; b++)
+          {
+            const size_t row_changes = (a != entry1) + (b != entry2);
+            if (row_changes <= 1 && ((value_pairs >> (a * 3 + b)) & 1))
+            {
+              rows_by_changes[row_changes][a * 3 + b].push_back(row);
+            }
+          }
+        }
+      }
+
+      size_t num_added_here = 0;
+      for (size_t k = 0; k < forbidden_codes.size() && num_added_here < per_col_pair; k++)
+      {
+        if (!((reachable_codes_[col1][col2] >> k) & 1))
+        {
+          continue;
+        }
+        const uint32_t code = forbidden_codes[k];
+        const uint32_t pairs[3] = {code / 81, code / 9 % 9, code % 9};
+        const vector<int> flattened_submatrix = submatrixEntries(code);
+
+        // which row of the submatrix has the changed entry, if any
+        for (size_t changed = 0; changed < 3 && num_added_here < per_col_pair; changed++)
+        {
+          const vector<size_t>& rows1 = rows_by_changes[changes && changed == 0][pairs[0]];
+          const vector<size_t>& rows2 = rows_by_changes[changes && changed == 1][pairs[1]];
+          const vector<size_t>& rows3 = rows_by_changes[changes && changed == 2][pairs[2]];
+          for (size_t i1 = 0; i1 < rows1.size() && num_added_here < per_col_pair; i1++)
+          {
+            for (size_t i2 = 0; i2 < rows2.size() && num_added_here < per_col_pair; i2++)
             {
-              AddForbiddenSubmatrixClause(flattened_submatrix, is_one_vars, is_two_vars, rows, cols);
+              for (size_t i3 = 0; i3 < rows3.size() && num_added_here < per_col_pair; i3++)
+              {
+                vector<size_t> rows{rows1[i1], rows2[i2], rows3[i3]};
+                if (rows[0] == rows[1] || rows[0] == rows[2] || rows[1] == rows[2])
+                {
+                  continue;
+                }
+                vector<size_t> cols{col1, col2};
+                vector<pair<size_t, size_t>> positions{{rows[0], col1}, {rows[0], col2},
+                                                       {rows[1], col1}, {rows[1], col2},
+                                                       {rows[2], col1}, {rows[2], col2}};
+                AddForbiddenSubmatrixClause(flattened_submatrix, GetSubmatrixVars(positions, 1),
+                                            GetSubmatrixVars(positions, 2), rows, cols);
+                num_added_here++;
+              }
             }
           }
+          if (changes == 0)
+          {
+            // all rows as in B, no changed row to pick
+            break;
+          }
         }
       }
+      num_added_now += num_added_here;
+      if (num_added + num_added_now >= warm_start_cuts_)
+      {
+        break;
+      }
     }
+    num_added += num_added_now;
+    std::cout << "Forbade " << num_added_now << " submatrices " << changes << " changed entries away from B" << std::endl;
   }
 }
 
+void SamplerDollo::LoadCutCache()
+{
+  CutCache cache(cut_cache_file_, GetInstanceHash());
+  if (!cache.load(cached_cuts_))
+  {
+    std::cout << "No cuts cached for this instance in " << cut_cache_file_ << std::endl;
+    return;
+  }
+
+  size_t num_added = 0;
+  for (const CutKey& key : cached_cuts_)
+  {
+    if (!(key.row1 < key.row2 && key.row2 < key.row3 && key.row3 < m_
+          && key.col1 < key.col2 && key.col2 < n_
+          && key.code < kNumSubmatrixCodes && isForbiddenUpToPermutation(key.code)))
+    {
+      std::cout << "Cut cache " << cut_cache_file_ << " is corrupt, ignoring the rest of it" << std::endl;
+      break;
+    }
+    if (!eager_col_pairs_.empty() && eager_col_pairs_[key.col1][key.col2])
+    {
+      continue;
+    }
+
+    vector<size_t> rows{key.row1, key.row2, key.row3};
+    vector<size_t> cols{key.col1, key.col2};
+    vector<pair<size_t, size_t>> positions{{key.row1, key.col1}, {key.row1, key.col2},
+                                           {key.row2, key.col1}, {key.row2, key.col2},
+                                           {key.row3, key.col1}, {key.row3, key.col2}};
+    AddForbiddenSubmatrixClause(submatrixEntries(key.code), GetSubmatrixVars(positions, 1),
+                                GetSubmatrixVars(positions, 2), rows, cols);
+    num_added++;
+  }
+  std::cout << "Added " << num_added << " cached cuts from " << cut_cache_file_ << std::endl;
+}
+
+int SamplerDollo::SeparateFixed(CuttingPlane *cutting_plane, const vector<Lit> &fixed, void *)
+{
+  return static_cast<CuttingPlaneDollo *>(cutting_plane)->separateFixed(fixed);
+}
+
+void SamplerDollo::SaveCutCache() const
+{
+  if (cut_cache_file_.empty() || !use_cutting_plane_)
+  {
+    return;
+  }
+
+  CutPool all_cuts(0);
+  for (const CutKey& key : cached_cuts_)
+  {
+    all_cuts.insert(key);
+  }
+  for (const CutKey& key : cutting_plane_->getCutPool().getKeys())
+  {
+    all_cuts.insert(key);
+  }
+  for (const auto& cutting_plane : worker_cutting_planes_)
+  {
+    for (const CutKey& key : cutting_plane->getCutPool().getKeys())
+    {
+      all_cuts.insert(key);
+    }
+  }
+
+  vector<CutKey> cuts(all_cuts.getKeys().begin(), all_cuts.getKeys().end());
+  CutCache cache(cut_cache_file_, GetInstanceHash());
+  if (cache.save(cuts))
+  {
+    std::cout << "Saved " << cuts.size() << " cuts to " << cut_cache_file_ << std::endl;
+  }
+  else
+  {
+    std::cout << "Cannot write cut cache " << cut_cache_file_ << std::endl;
+  }
+}
+
+uint64_t SamplerDollo::GetInstanceHash() const
+{
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto add = [&hash](uint64_t value) {
+    for (size_t i = 0; i < 8; i++)
+    {
+      hash ^= (value >> (i * 8)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+  };
+
+  add(m_);
+  add(n_);
+  for (size_t i = 0; i < m_; i++)
+  {
+    for (size_t j = 0; j < n_; j++)
+    {
+      add(B_.getEntry(i, j));
+    }
+  }
+  add(k_);
+  add(num_cell_clusters_);
+  add(num_mutation_clusters_);
+  add(num_fn_);
+  add(num_fp_);
+  for (size_t j = 0; j < n_; j++)
+  {
+    add(IsLossForbidden(j));
+  }
+  return hash;
+}
+
 void SamplerDollo::AddForbiddenSubmatrixClause(const vector<int> &forbidden_submatrix, const vector<int> &is_one_vars, const vector<int> &is_two_vars,
                                               const vector<size_t>& rows, const vector<size_t>& cols)
 {
@@ -542,13 +1224,28 @@ void SamplerDollo::AddForbiddenSubmatrixClause(const vector<int> &forbidden_subm
   AddClause(clause);
 }
 
-void SamplerDollo::UpdateIndependentSet()
+vector<uint32_t> SamplerDollo::GetIndependentSupport() const
 {
-  vector<uint32_t> indep_set;
-  for (int i = 0; i < num_vars_; ++i)
+  // every other variable is defined from these: the pair equal and duplicate
+  // variables by the clustering clauses, the pattern variables by the compact
+  // encoding, the adders' sums and carries by their gates, and variable 0 is true
+  vector<uint32_t> support;
+  for (size_t i = 0; i < m_; i++)
   {
-    indep_set.push_back(i);
+    for (size_t j = 0; j < n_; j++)
+    {
+      support.push_back(loss_vars_[i][j]);
+      support.push_back(B_.getEntry(i, j) == 1 ? false_pos_vars_[i][j] : false_neg_vars_[i][j]);
+    }
   }
+  std::sort(support.begin(), support.end());
+  return support;
+}
+
+void SamplerDollo::UpdateIndependentSet()
+{
+  vector<uint32_t> indep_set = GetIndependentSupport();
+  std::cout << "Independent support: " << indep_set.size() << " of " << num_vars_ << " vars\n";
   approxmc_->set_projection_set(indep_set);
 }
 
@@ -556,18 +1253,14 @@ void SamplerDollo::UpdateSamplingSet()
 {
   // Update sampling set
   std::cout << num_vars_ << " vars created total\n";
-  SATSolver *solver = approxmc_->get_solver();
-  solver->new_vars(num_vars_);
+  unigen_->new_vars(num_vars_);
 
-  vector<uint32_t> sampling_set;
-  for (int i = 0; i < num_vars_; ++i)
-  {
-    sampling_set.push_back(i);
-  }
+  vector<uint32_t> sampling_set = GetIndependentSupport();
+  std::cout << "Sampling set: " << sampling_set.size() << " of " << num_vars_ << " vars\n";
   approxmc_->set_sampling_set(sampling_set);
 }
 
-void SamplerDollo::PrintClusteredMatrix(const map<int, bool> &sol_map, const vector<vector<int>> &sol_matrix, std::ostream &os) const
+void SamplerDollo::PrintClusteredMatrix(const map<int, bool> &sol_map, const vector<vector<int>> &sol_matrix, SampleWriter &writer) const
 {
   for (size_t i = 0; i < m_; i++)
   {
@@ -581,9 +1274,10 @@ void SamplerDollo::PrintClusteredMatrix(const map<int, bool> &sol_map, const vec
       {
         continue;
       }
-      os << sol_matrix[i][j] << " ";
+      writer.write_int(sol_matrix[i][j]);
+      writer.write_char(' ');
     }
-    os << "\n";
+    writer.write_char('\n');
   }
 }
 
@@ -932,6 +1626,19 @@ vector<int> SamplerDollo::GetEntryIsZeroVars(size_t row, size_t col) const
   return zero_vars;
 }
 
+vector<int> SamplerDollo::GetEntryValueVars(size_t row, size_t col, int value) const
+{
+  if (value == 0)
+  {
+    return GetEntryIsZeroVars(row, col);
+  }
+  if (value == 1)
+  {
+    return vector<int>{GetEntryIsOneVar(row, col)};
+  }
+  return vector<int>{loss_vars_[row][col]};
+}
+
 void SamplerDollo::AddClause(const vector<int> &clause)
 {
   vector<Lit> lits;
@@ -944,7 +1651,7 @@ void SamplerDollo::AddClause(const vector<int> &clause)
     Lit lit(label, is_inverted);
     lits.push_back(lit);
   }
-  approxmc_->add_clause(lits);
+  unigen_->add_clause(lits);
 }
 
 void SamplerDollo::AddClauses(const vector<vector<int>> &clauses)
@@ -1011,18 +1718,6 @@ void SamplerDollo::SetPairOfVarsEqual(const vector<int> &entry1, const vector<in
   AddImplyClauses(lhs, entry1);
 }
 
-vector<int> SamplerDollo::GetForbiddenSubmatrixFromString(const std::string &submatrix_str)
-{
-  vector<int> flattened_submatrix;
-
-  for (size_t i = 0; i < submatrix_str.size(); i++) {
-    int entry = submatrix_str[i] - '0';
-    flattened_submatrix.push_back(entry);
-  }
-
-  return flattened_submatrix;
-}
-
 vector<int> SamplerDollo::GetSubmatrixVars(const vector<pair<size_t, size_t>> &submatrix_positions, int entry)
 {
   vector<int> vars;
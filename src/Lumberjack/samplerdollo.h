@@ -13,8 +13,11 @@
 #include "cuttingplanedollo.h"
 #include "unigen/unigen.h"
 #include "adder.h"
+#include "cutcache.h"
+#include "../samplewriter.h"
 #include <map>
 #include <vector>
+#include <memory>
 #include <unordered_set>
 
 using namespace UniGen;
@@ -24,6 +27,19 @@ using std::map;
 using std::vector;
 using std::unordered_set;
 
+/// How forbidden submatrices are kept out of the solutions
+enum class CutStrategy
+{
+  /// All clauses in the formula up front
+  Eager,
+  /// Cuts added by the cutting plane as models violate them
+  Lazy,
+  /// Clauses up front for the column pairs likely to conflict, cuts for the rest
+  Hybrid,
+  /// Picked by Init from the estimated size of each
+  Auto
+};
+
 /// This class provides a cutting plane wrapper for CryptoMiniSAT
 /// This can be used to solve the the k-DP problem .
 class SamplerDollo
@@ -35,28 +51,100 @@ public:
   /// @param k Maximum number of losses per character
   /// @param appmc pointer to ApproxMC object
   /// @param unigen pointer to UniGen object
+  /// @param strategy how to keep forbidden submatrices out
   /// @param false_pos_rate rate at which false positives occur in SCS data
   /// @param false_neg_rate rate at which false negatives occur in SCS data
+  /// @param separation_threads number of threads each cutting plane separates with
+  /// @param max_cuts_per_round most cuts a cutting plane adds per model, 0 for no limit
+  /// @param compact_encoding without cutting plane, forbid submatrices per column pair
+  /// pattern instead of per row triple
+  /// @param warm_start_cuts with cutting plane, most forbidden submatrices to forbid up front,
+  /// those closest to B first
+  /// @param cut_cache_file with cutting plane, file of the cuts of earlier runs on
+  /// the same instance, empty for none
+  /// @param separate_fixed with cutting plane, also separate what the solver fixed at
+  /// decision level 0 before every solve
   SamplerDollo(const Matrix& B, size_t k, AppMC* appmc, UniG* unigen, 
      size_t cell_clusters, size_t mutation_clusters,
      double false_pos_rate=0.01, double false_neg_rate=0.5,
      const unordered_set<size_t>* allowed_losses=nullptr,
-     bool use_cutting_plane=true);
+     CutStrategy strategy=CutStrategy::Auto,
+     size_t separation_threads=1,
+     size_t max_cuts_per_round=0,
+     bool compact_encoding=true,
+     size_t warm_start_cuts=0,
+     const string& cut_cache_file="",
+     bool separate_fixed=false);
   
   /// Initializes solver
   virtual void Init();
+
+  /// Passed on to the cutting planes, call before Init
+  void SetVerbosity(uint32_t verbosity) { verbosity_ = verbosity; }
+
+  /// The strategy in use, the one picked for auto once Init has run
+  CutStrategy GetCutStrategy() const { return strategy_; }
   
   /// Samples solutions from current 1-Dollo instance
   /// @param sol_count
   /// @param num_samples desired number of samples
   /// @param out_filename where to direct output samples (pass in nullptr for std::out)
   void Sample(const SolCount *sol_count, uint32_t num_samples, string* out_filename);
+
+  /// Builds a cutting plane oracle bound to a sampling worker's solver
+  /// @param solver the worker's cloned solver
+  /// @param data the SamplerDollo instance that owns the oracle
+  static CuttingPlane* CreateWorkerCuttingPlane(SATSolver* solver, void* data);
+
+  /// Moves a cutting plane to a rebuilt solver, as a UniGen::cutting_plane_rebinder
+  /// @param cutting_plane a CuttingPlaneDollo
+  static void RebindCuttingPlane(CuttingPlane* cutting_plane, SATSolver* solver, void* data);
+
+  /// Separates a cutting plane on fixed literals, as a UniGen::fixed_separator
+  /// @param cutting_plane a CuttingPlaneDollo
+  static int SeparateFixed(CuttingPlane* cutting_plane, const vector<Lit>& fixed, void* data);
+
+  /// Writes the cuts of the cache file and those found by all cutting planes
+  /// so far back to the cache file, if there is one
+  void SaveCutCache() const;
   
 protected:
 
   /// Initializes variable matrices that define entries of corrected matrix
   void InitializeVariableMatrices();
 
+  /// Sets the maximum numbers of false negatives and false positives
+  void InitializeErrorBudgets();
+
+  /// Finds, for every column pair, the forbidden submatrices some choice of
+  /// entries within the error budgets and allowed losses could show
+  void InitializeReachableCodes();
+
+  /// Gets the value pairs the entries of a row in two columns can take
+  /// within the error budgets
+  /// @param entry1 entry of B in col1
+  /// @param entry2 entry of B in col2
+  /// @return bit a * 3 + b is set if the entries can be a and b
+  uint32_t GetReachableValuePairs(int entry1, int entry2, size_t col1, size_t col2) const;
+
+  /// Is the given column forbidden to have losses? Without allowed_losses_
+  /// every column may lose its mutation, with it only the listed ones
+  bool IsLossForbidden(size_t col) const;
+
+  /// Initializes the pattern variables of the compact encoding, for the column
+  /// pairs in eager_col_pairs_ and the value pairs of their reachable codes
+  void InitializePatternVariables();
+
+  /// Estimates the size of the formula with each strategy, logs the
+  /// estimates and picks the strategy to use. Also sets eager_col_pairs_
+  /// for a hybrid
+  CutStrategy ChooseCutStrategy();
+
+  /// Does the input matrix have rows 01, 10 and 11 in the given columns?
+  /// Without errors or losses such a column pair cannot be a perfect
+  /// phylogeny, so the solver will run into its forbidden submatrices
+  bool IsConflictingColPair(size_t col1, size_t col2) const;
+
   /*
     METHODS TO ADD CLAUSES TO INITIAL FORMULA
   */
@@ -91,6 +179,28 @@ protected:
   /// Adds clauses that enforce absence of forbidden submatrices
   void AddCuttingPlaneClauses();
 
+  /// Adds clauses that enforce absence of forbidden submatrices, in O(m*n^2) clauses:
+  /// row_shows_pattern[col1][col2][pattern][row] <=> 
+  /// row is not a duplicate and has value pair pattern in col1, col2
+  /// and
+  /// col_pair_shows_pattern[col1][col2][pattern] <=>
+  /// row_shows_pattern[col1][col2][pattern][0] or ... or row_shows_pattern[col1][col2][pattern][m-1]
+  /// and, for each forbidden submatrix with rows of value pairs p1, p2, p3,
+  /// not all of col_pair_shows_pattern[col1][col2][p1], [p2], [p3] unless col1 or col2 is a duplicate
+  void AddPatternClauses();
+
+  /// Forbids up to warm_start_cuts_ submatrices up front in the column pairs
+  /// left to the cutting plane: first those B shows as is, then those one
+  /// changed entry away from B, spread evenly over the column pairs
+  void AddWarmStartClauses();
+
+  /// Adds the cuts saved in the cut cache file for this instance
+  void LoadCutCache();
+
+  /// Gets a hash of the input matrix, cluster counts, error budgets and
+  /// allowed losses, which the cuts found depend on
+  uint64_t GetInstanceHash() const;
+
   /// Adds one clause forbidding a given submatrix
   void AddForbiddenSubmatrixClause(const vector<int>& forbidden_submatrix, const vector<int>& is_one_vars, const vector<int>& is_two_vars, const vector<size_t>& rows, const vector<size_t>& cols);
 
@@ -103,7 +213,7 @@ protected:
   /// Prints out a clustered matrix, omitting duplicate rows/columns
   /// @param sol_map a mapping of variable labels to truth values
   /// @param sol_matrix the resulting output matrix of a solution (unclustered)
-  void PrintClusteredMatrix(const map<int, bool>& sol_map, const vector<vector<int>>& sol_matrix, std::ostream& os) const;
+  void PrintClusteredMatrix(const map<int, bool>& sol_map, const vector<vector<int>>& sol_matrix, SampleWriter& writer) const;
 
   /// Gets a map representing truth assignments for a solution
   /// @param solution a vector of ints each entry is a variable, which is assigned 
@@ -143,9 +253,15 @@ protected:
   /// Helper method that gets an adder object for the current instance
   Adder GetAdder();
 
-  /// Updates approxmc_'s sampling set with new variables
+  /// Gets the loss and false positive/negative variables, which determine
+  /// every other variable of the encoding
+  vector<uint32_t> GetIndependentSupport() const;
+
+  /// Creates the variables in the solver and sets approxmc_'s sampling set
+  /// to the independent support
   void UpdateSamplingSet();
 
+  /// Sets approxmc_'s projection set to the independent support
   void UpdateIndependentSet();
   
   /// Helper method that prints out all the variable matrices for an instance
@@ -163,6 +279,10 @@ protected:
   /// @return variable label
   vector<int> GetEntryIsZeroVars(size_t row, size_t col) const;
 
+  /// Gets the literals that together say that the entry at row, col has a value
+  /// @param value 0, 1 or 2
+  vector<int> GetEntryValueVars(size_t row, size_t col, int value) const;
+
   /// Adds clauses to current formula
   /// @param clauses clauses to add
   void AddClauses(const vector<vector<int>>& clauses);
@@ -189,8 +309,6 @@ protected:
   /// Overloaded function for when multiple variables correspond to one entry
   void SetPairOfVarsEqual(const vector<int>& entry1, const vector<int>& entry2, int pair_equal_var);
 
-  vector<int> GetForbiddenSubmatrixFromString(const std::string& submatrix_str);
-
   vector<int> GetSubmatrixVars(const vector<pair<size_t, size_t>> &submatrix_positions, int entry);
 
 protected:
@@ -212,6 +330,7 @@ protected:
   size_t num_fn_ = 0;
   size_t num_fp_ = 0;
 
+  /// Columns that may lose their mutation, all of them when null
   const unordered_set<size_t>* allowed_losses_;
 
   /// Number of cell clusters in clustered output matrix
@@ -240,13 +359,47 @@ protected:
   vector<int> row_is_duplicate_;
   /// col_is_duplicate_[i] is true if col i is a duplicate of some previous col 0,1,..,i-1
   vector<int> col_is_duplicate_;
+
+  /// col_pair_shows_pattern_[i][j][p] is true if some non-duplicate row has value pair p
+  /// (value in col i * 3 + value in col j) in cols i < j. Only set for the value pairs
+  /// that are a row of a forbidden submatrix
+  StlInt3Matrix col_pair_shows_pattern_;
+  /// row_shows_pattern_[i][j][p][k] is true if row k is not a duplicate and has value pair p in cols i < j
+  vector<StlInt3Matrix> row_shows_pattern_;
   
   /// Number of variables
   int num_vars_;
   /// Number of constraints
   int num_constraints_;
 
+  /// How forbidden submatrices are kept out, decided by Init if Auto
+  CutStrategy strategy_;
   bool use_cutting_plane_;
+  /// eager_col_pairs_[i][j] is true if the forbidden submatrices of cols i < j
+  /// are in the formula
+  StlBoolMatrix eager_col_pairs_;
+  /// bit k of reachable_codes_[i][j] is set if sortedForbiddenSubmatrixCodes()[k]
+  /// can show up in cols i < j
+  vector<vector<uint32_t>> reachable_codes_;
+
+  /// Number of threads each cutting plane separates with
+  const size_t separation_threads_;
+  /// Most cuts each cutting plane adds per model, 0 for no limit
+  const size_t max_cuts_per_round_;
+  /// Whether to forbid submatrices per column pair pattern, without cutting plane
+  const bool compact_encoding_;
+  /// Most forbidden submatrices to forbid up front with cutting plane
+  const size_t warm_start_cuts_;
+  /// File of the cuts of earlier runs, empty for none
+  const string cut_cache_file_;
+  /// Whether to separate the literals fixed at decision level 0 before every solve
+  const bool separate_fixed_;
+  /// Verbosity of the cutting planes
+  uint32_t verbosity_ = 1;
+  /// Cuts read from cut_cache_file_
+  vector<CutKey> cached_cuts_;
+  /// Cuts found by the cutting planes of all sampling workers
+  SharedCutStore shared_cuts_;
   
   /// Approx MC solver
   AppMC* approxmc_;
@@ -254,12 +407,8 @@ protected:
   UniG* unigen_;
   /// Cutting plane oracle
   CuttingPlaneDollo* cutting_plane_;
-
-  const unordered_set<string> forbidden_submatrices_ {"100111", "100112", "100211", "100212", "100121",
-                                            "100122", "100221", "100222", "200111", "200112",
-                                            "200211", "200212", "200121", "200122", "200221",
-                                            "200222", "110212", "110222", "210212", "210222",
-                                            "201121", "201122", "201221", "201222", "211222"};
+  /// Cutting plane oracles of the sampling workers
+  vector<std::unique_ptr<CuttingPlaneDollo>> worker_cutting_planes_;
 };
 
 #endif // COLUMNGEN_H
@@ -0,0 +1,88 @@
+/*
+ * workerpool.cpp
+ *
+ */
+
+#include "workerpool.h"
+
+WorkerPool::WorkerPool(size_t num_workers)
+{
+  for (size_t worker = 1; worker < num_workers; worker++)
+  {
+    threads_.emplace_back(&WorkerPool::loop, this, worker);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& thread : threads_)
+  {
+    thread.join();
+  }
+}
+
+void WorkerPool::run(size_t n, const std::function<void(size_t, size_t)>& body)
+{
+  if (threads_.empty() || n < 2)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      body(0, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    body_ = &body;
+    n_ = n;
+    next_ = 0;
+    num_busy_ = threads_.size();
+    generation_++;
+  }
+  start_.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(mu_);
+  finished_.wait(lock, [this] { return num_busy_ == 0; });
+  body_ = nullptr;
+}
+
+void WorkerPool::work(size_t worker)
+{
+  for (size_t i = next_++; i < n_; i = next_++)
+  {
+    (*body_)(worker, i);
+  }
+}
+
+void WorkerPool::loop(size_t worker)
+{
+  size_t seen_generation = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      start_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+      if (stop_)
+      {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    work(worker);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (--num_busy_ == 0)
+    {
+      finished_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * workerpool.h
+ *
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of threads that repeatedly run a loop body over a range of
+/// indices. The calling thread takes part as worker 0.
+class WorkerPool
+{
+public:
+  /// Constructor
+  /// @param num_workers total number of workers, including the caller
+  explicit WorkerPool(size_t num_workers);
+
+  ~WorkerPool();
+
+  size_t getNumWorkers() const
+  {
+    return threads_.size() + 1;
+  }
+
+  /// Calls body(worker, i) for every i < n, each index on one worker in
+  /// increasing order per worker. Returns when all are done
+  void run(size_t n, const std::function<void(size_t, size_t)>& body);
+
+private:
+  void work(size_t worker);
+  void loop(size_t worker);
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mu_;
+  std::condition_variable start_;
+  std::condition_variable finished_;
+  /// Bumped for every run, workers wait for it to change
+  size_t generation_ = 0;
+  size_t num_busy_ = 0;
+  bool stop_ = false;
+
+  const std::function<void(size_t, size_t)>* body_ = nullptr;
+  size_t n_ = 0;
+  std::atomic<size_t> next_{0};
+};
+
+#endif // WORKERPOOL_H
@@ -39,7 +39,13 @@ struct Config {
     bool only_indep_samples = true;
     uint32_t multisample = 1;
     int force_sol_extension = 0;
+    int defer_sol_extension = 0; //1: extend on the solver, 2: on a copy of it
     double kappa = 0.638;      /* Corresponds to epsilon=16 */
+    uint32_t num_threads = 1;
+    int reservoir = 0;
+    int sparse_sampling = 0;
+    int sink_only = 0;
+    uint32_t sink_queue = 0;
     std::ostream* logfile = NULL;
 };
 
@@ -38,6 +38,8 @@ using std::vector;
 #include "config.h"
 #include "unigen/unigen.h"
 #include "time_mem.h"
+#include "samplewriter.h"
+#include "samplefile.h"
 #include <approxmc/approxmc.h>
 #include <fstream>
 
@@ -71,13 +73,20 @@ double var_elim_ratio;
 uint32_t detach_xors = 1;
 uint32_t reuse_models = 1;
 uint32_t force_sol_extension = 0;
+uint32_t defer_sol_extension;
 uint32_t sparse;
+uint32_t num_threads = 1;
 
 //sampling
 uint32_t num_samples = 20;
 int only_indep_samples ;
 int multisample;
+int reservoir;
+int sparse_sampling;
+int rebuild_solver = 1;
+uint32_t sink_queue;
 std::string sample_fname;
+std::string sample_bin_fname;
 double kappa;      /* Corresponds to epsilon=16 */
 bool verb_sampler_cls ;
 
@@ -101,8 +110,12 @@ void add_UniGen_options()
     UniG tmp2(NULL);
     kappa = tmp2.get_kappa();
     multisample = tmp2.get_multisample();
+    reservoir = tmp2.get_reservoir();
+    sparse_sampling = tmp2.get_sparse_sampling();
+    sink_queue = tmp2.get_sink_queue();
     only_indep_samples = tmp2.get_only_indep_samples();
     force_sol_extension = tmp2.get_force_sol_extension();
+    defer_sol_extension = tmp2.get_defer_sol_extension();
     verb_sampler_cls = tmp2. get_verb_sampler_cls();
 
     std::ostringstream my_epsilon;
@@ -133,12 +146,16 @@ void add_UniGen_options()
     improvement_options.add_options()
     ("sparse", po::value(&sparse)->default_value(sparse)
         , "Generate sparse XORs when possible")
+    ("sparsesampling", po::value(&sparse_sampling)->default_value(sparse_sampling)
+        , "With --sparse, also sample with sparse XORs. Faster, but the samples are no longer guaranteed to be almost-uniform")
     ("detachxor", po::value(&detach_xors)->default_value(detach_xors)
         , "Detach XORs in CMS")
     ("reusemodels", po::value(&reuse_models)->default_value(reuse_models)
         , "Reuse models while counting solutions")
     ("forcesolextension", po::value(&force_sol_extension)->default_value(force_sol_extension)
         , "Use trick of not extending solutions in the SAT solver to full solution")
+    ("defersolext", po::value(&defer_sol_extension)->default_value(defer_sol_extension)
+        , "Solve on the sampling set only and extend just the output samples. 0 = off, 1 = extend on the sampling solver, 2 = extend on a copy of it")
     ;
 
     misc_options.add_options()
@@ -159,10 +176,20 @@ void add_UniGen_options()
         , "Return multiple samples from each call")
     ("sampleout", po::value(&sample_fname)
         , "Write samples to this file")
+    ("samplebin", po::value(&sample_bin_fname)
+        , "Write samples bit-packed to this binary file instead of as text, see samplefile.h")
     ("kappa", po::value(&kappa)->default_value(kappa, my_kappa.str())
         , "Uniformity parameter (see TACAS-15 paper)")
     ("verbsamplercls", po::value(&verb_sampler_cls)->default_value(verb_sampler_cls)
         , "Print XOR constraints added for sampling")
+    ("reservoir", po::value(&reservoir)->default_value(reservoir)
+        , "When all solutions are enumerated, keep only a reservoir of the samples")
+    ("samplequeue", po::value(&sink_queue)->default_value(sink_queue)
+        , "Write samples from a separate thread, sampling waits while this many are queued. 0 writes them directly")
+    ("threads", po::value(&num_threads)->default_value(num_threads)
+        , "Number of threads to sample with, each with its own solver")
+    ("rebuild", po::value(&rebuild_solver)->default_value(rebuild_solver)
+        , "Rebuild the sampling solver from the input formula from time to time, to drop retired hash and banning variables. Keeps a copy of the formula, as do --threads above 1 and --defersolext 2, which doubles the memory the formula takes")
     ;
 
     help_options.add(main_options);
@@ -278,10 +305,10 @@ void read_in_file(const string& filename)
 {
     #ifndef USE_ZLIB
     FILE * in = fopen(filename.c_str(), "rb");
-    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<FILE*, FN>, UniG> parser(unigen, NULL, verbosity);
     #else
     gzFile in = gzopen(filename.c_str(), "rb");
-    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<gzFile, GZ>, UniG> parser(unigen, NULL, verbosity);
     #endif
 
     if (in == NULL) {
@@ -324,9 +351,9 @@ void read_stdin()
     }
 
     #ifndef USE_ZLIB
-    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<FILE*, FN>, UniG> parser(unigen, NULL, verbosity);
     #else
-    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<gzFile, GZ>, UniG> parser(unigen, NULL, verbosity);
     #endif
 
     if (!parser.parse_DIMACS(in, false)) {
@@ -340,13 +367,9 @@ void read_stdin()
     #endif
 }
 
-void mycallback(const std::vector<int>& solution, void *file)
+void mycallback(const std::vector<int>& solution, void *writer)
 {
-    std::ostream* os = (std::ostream*)file;
-    for(uint32_t i = 0; i < solution.size(); i++) {
-        (*os) << solution[i] <<  " ";
-    }
-    (*os) << "0" << endl;
+    ((SampleWriter*)writer)->write_sample(solution);
 }
 
 int main(int argc, char** argv)
@@ -370,6 +393,8 @@ int main(int argc, char** argv)
     appmc = new ApproxMC::AppMC;
     unigen = new UniG(appmc);
     add_supported_options(argc, argv);
+    unigen->set_record_input(
+        num_threads > 1 || defer_sol_extension == 2 || rebuild_solver);
     if (verbosity) {
         cout << unigen->get_version_info();
         cout << "c executed with command line: " << command_line << endl;
@@ -416,6 +441,13 @@ int main(int argc, char** argv)
     unigen->set_multisample(multisample);
     unigen->set_only_indep_samples(only_indep_samples);
     unigen->set_force_sol_extension(force_sol_extension);
+    unigen->set_defer_sol_extension(defer_sol_extension);
+    unigen->set_num_threads(num_threads);
+    unigen->set_reservoir(reservoir);
+    unigen->set_sparse_sampling(sparse_sampling);
+    unigen->set_sink_queue(sink_queue);
+    //Samples are only written by the callback, nothing to return
+    unigen->set_sink_only(true);
 
     std::ofstream logfile;
     if (logfilename != "") {
@@ -440,8 +472,22 @@ int main(int argc, char** argv)
         myfile = &sample_out;
     }
 
-    unigen->set_callback(mycallback, myfile);
+    SampleWriter sample_writer((std::ostream*)myfile);
+    unigen->set_callback(mycallback, &sample_writer);
+    SampleFileWriter* sample_bin = NULL;
+    if (vm.count("samplebin") != 0) {
+        sample_bin = new SampleFileWriter(sample_bin_fname, seed);
+        if (!sample_bin->is_open()) {
+            cout << "[Sampler] Cannot open binary samples file '" << sample_bin_fname
+                 << "' for writing." << endl;
+            exit(-1);
+        }
+        unigen->set_packed_callback(
+            SampleFileWriter::add_sample, SampleFileWriter::setup, sample_bin);
+    }
     unigen->sample(&sol_count, num_samples);
+    sample_writer.finish();
+    delete sample_bin;
 
     delete unigen;
     delete appmc;
@@ -0,0 +1,93 @@
+/*
+ Packed bit vectors over the sampling set
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef PACKEDBITS_H__
+#define PACKEDBITS_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//Bit i of a packed vector is bit (i % 64) of word (i / 64). For hashes and
+//models, bit i belongs to the i-th variable of the sampling set.
+typedef std::vector<uint64_t> PackedBits;
+
+inline size_t packed_words(const size_t num_bits)
+{
+    return (num_bits + 63) / 64;
+}
+
+inline void set_packed_bit(PackedBits& bits, const size_t i)
+{
+    bits[i / 64] |= 1ULL << (i % 64);
+}
+
+inline bool get_packed_bit(const PackedBits& bits, const size_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1ULL;
+}
+
+inline uint32_t popcount64(const uint64_t x)
+{
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+    #else
+    uint64_t v = x - ((x >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (v * 0x0101010101010101ULL) >> 56;
+    #endif
+}
+
+//Parity of popcount(a & b). The XOR-reduction has no dependency between the
+//words, so the compiler vectorizes the loop and only one popcount is needed.
+inline bool and_parity(const uint64_t* a, const uint64_t* b, const size_t num_words)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < num_words; i++) {
+        acc ^= a[i] & b[i];
+    }
+    return popcount64(acc) & 1U;
+}
+
+//Calls f(i) for every set bit i, in increasing order
+template<class F>
+inline void for_each_set_bit(const PackedBits& bits, F f)
+{
+    for (size_t w = 0; w < bits.size(); w++) {
+        uint64_t word = bits[w];
+        while (word) {
+            #if defined(__GNUC__) || defined(__clang__)
+            const uint32_t at = __builtin_ctzll(word);
+            #else
+            uint32_t at = 0;
+            while (!((word >> at) & 1ULL)) at++;
+            #endif
+            f(w * 64 + at);
+            word &= word - 1;
+        }
+    }
+}
+
+#endif //PACKEDBITS_H__
@@ -0,0 +1,214 @@
+/*
+ Binary sample files
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "samplefile.h"
+#include "packedbits.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using std::vector;
+using std::string;
+using std::cout;
+using std::endl;
+
+static const char sample_file_magic[8] = {'U','N','I','G','S','M','P','L'};
+static const size_t header_size = 8 + 4 + 4 + 8 + 8;
+static const size_t num_samples_offset = 8 + 4 + 4 + 8;
+
+static size_t vars_size_padded(const uint32_t num_vars)
+{
+    return (num_vars * sizeof(uint32_t) + 7) / 8 * 8;
+}
+
+SampleFileWriter::SampleFileWriter(const string& fname, const uint64_t _seed) :
+    out(fname.c_str(), std::ios::out | std::ios::binary | std::ios::trunc),
+    seed(_seed)
+{
+}
+
+SampleFileWriter::~SampleFileWriter()
+{
+    close();
+}
+
+void SampleFileWriter::write_header()
+{
+    const uint32_t version = sample_file_version;
+    const uint32_t num_vars = vars.size();
+    out.write(sample_file_magic, sizeof(sample_file_magic));
+    out.write((const char*)&version, sizeof(version));
+    out.write((const char*)&num_vars, sizeof(num_vars));
+    out.write((const char*)&seed, sizeof(seed));
+    out.write((const char*)&num_samples, sizeof(num_samples));
+    out.write((const char*)vars.data(), vars.size() * sizeof(uint32_t));
+
+    const char zeros[8] = {0};
+    out.write(zeros, vars_size_padded(num_vars) - vars.size() * sizeof(uint32_t));
+    header_written = true;
+}
+
+void SampleFileWriter::setup(const vector<uint32_t>& vars, void* writer)
+{
+    SampleFileWriter* w = (SampleFileWriter*)writer;
+    assert(!w->header_written);
+    w->vars = vars;
+    w->write_header();
+}
+
+void SampleFileWriter::add_sample(const uint64_t* bits, uint32_t num_bits, void* writer)
+{
+    SampleFileWriter* w = (SampleFileWriter*)writer;
+    assert(w->header_written && num_bits == w->vars.size());
+    w->out.write((const char*)bits, packed_words(num_bits) * sizeof(uint64_t));
+    w->num_samples++;
+}
+
+void SampleFileWriter::close()
+{
+    if (!out.is_open()) {
+        return;
+    }
+
+    //No samples were ever asked for, the file is still valid
+    if (!header_written) {
+        write_header();
+    }
+    out.seekp(num_samples_offset);
+    out.write((const char*)&num_samples, sizeof(num_samples));
+    out.close();
+}
+
+SampleFileReader::SampleFileReader(const string& fname)
+{
+    #ifdef _WIN32
+    std::ifstream in(fname.c_str(), std::ios::in | std::ios::binary);
+    if (!in) {
+        fail("cannot open '" + fname + "'");
+        return;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    size = contents.size();
+    base = contents.data();
+    #else
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1) {
+        fail("cannot open '" + fname + "': " + strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        fail("'" + fname + "' is empty or cannot be read");
+        return;
+    }
+    size = st.st_size;
+    void* mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        fail("cannot map '" + fname + "': " + strerror(errno));
+        return;
+    }
+    base = (const char*)mem;
+    #endif
+
+    uint32_t version = 0;
+    if (size < header_size
+        || memcmp(base, sample_file_magic, sizeof(sample_file_magic)) != 0
+    ) {
+        fail("'" + fname + "' is not a sample file");
+        return;
+    }
+    memcpy(&version, base + 8, sizeof(version));
+    memcpy(&num_vars, base + 12, sizeof(num_vars));
+    memcpy(&seed, base + 16, sizeof(seed));
+    memcpy(&num_samples, base + num_samples_offset, sizeof(num_samples));
+    if (version != sample_file_version) {
+        fail("sample file '" + fname + "' has version " + std::to_string(version)
+            + ", only " + std::to_string(sample_file_version) + " is supported");
+        return;
+    }
+
+    //The counts come from the file, so no product of them may overflow
+    words_per_sample = packed_words(num_vars);
+    const size_t records_at = header_size + vars_size_padded(num_vars);
+    const size_t record_size = words_per_sample * sizeof(uint64_t);
+    if (size < records_at
+        || (record_size > 0 && (size - records_at) / record_size < num_samples)
+    ) {
+        fail("sample file '" + fname + "' is truncated");
+        return;
+    }
+    //Both offsets are multiples of 8 and mmap is page aligned
+    vars = (const uint32_t*)(base + header_size);
+    records = (const uint64_t*)(base + records_at);
+}
+
+SampleFileReader::~SampleFileReader()
+{
+    unmap();
+}
+
+void SampleFileReader::fail(const string& why)
+{
+    error = why;
+    unmap();
+}
+
+//Leaves the reader closed
+void SampleFileReader::unmap()
+{
+    #ifndef _WIN32
+    if (base != NULL) {
+        munmap((void*)base, size);
+    }
+    #else
+    contents.clear();
+    #endif
+    base = NULL;
+    size = 0;
+    num_samples = 0;
+    num_vars = 0;
+    vars = NULL;
+    records = NULL;
+}
+
+vector<int> SampleFileReader::get_sample_ints(const uint64_t i) const
+{
+    vector<int> solution(num_vars);
+    for (uint32_t j = 0; j < num_vars; j++) {
+        solution[j] = (get_value(i, j) ? 1 : -1) * ((int)vars[j] + 1);
+    }
+    return solution;
+}
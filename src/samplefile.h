@@ -0,0 +1,138 @@
+/*
+ Binary sample files
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef SAMPLEFILE_H__
+#define SAMPLEFILE_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//Layout, in host byte order:
+//  char     magic[8]     "UNIGSMPL"
+//  uint32_t version
+//  uint32_t num_vars
+//  uint64_t seed
+//  uint64_t num_samples
+//  uint32_t vars[num_vars]  (0-based), zero-padded to a multiple of 8 bytes
+//  then num_samples records of ceil(num_vars/64) uint64_t words each, bit j
+//  of a record being the value of vars[j] as in packedbits.h
+constexpr uint32_t sample_file_version = 1;
+
+class SampleFileWriter {
+public:
+    SampleFileWriter(const std::string& fname, const uint64_t seed);
+    ~SampleFileWriter();
+    bool is_open() const
+    {
+        return out.is_open();
+    }
+
+    //Matching UniGen::packed_setup and UniGen::packed_callback
+    static void setup(const std::vector<uint32_t>& vars, void* writer);
+    static void add_sample(const uint64_t* bits, uint32_t num_bits, void* writer);
+
+    //Writes the final sample count into the header
+    void close();
+
+private:
+    void write_header();
+
+    std::ofstream out;
+    uint64_t seed;
+    std::vector<uint32_t> vars;
+    uint64_t num_samples = 0;
+    bool header_written = false;
+};
+
+//Random access to the samples of a file without parsing them. A file that
+//cannot be read leaves the reader closed, get_error() tells why
+class SampleFileReader {
+public:
+    explicit SampleFileReader(const std::string& fname);
+    ~SampleFileReader();
+    bool is_open() const
+    {
+        return records != NULL;
+    }
+    const std::string& get_error() const
+    {
+        return error;
+    }
+
+    uint64_t get_seed() const
+    {
+        return seed;
+    }
+    uint64_t get_num_samples() const
+    {
+        return num_samples;
+    }
+    uint32_t get_num_vars() const
+    {
+        return num_vars;
+    }
+    uint32_t get_var(const uint32_t j) const
+    {
+        return vars[j];
+    }
+
+    //Throws std::out_of_range unless i < get_num_samples()
+    const uint64_t* get_sample(const uint64_t i) const
+    {
+        if (i >= num_samples) {
+            throw std::out_of_range("sample index past the end of the sample file");
+        }
+        return records + i * words_per_sample;
+    }
+    bool get_value(const uint64_t i, const uint32_t j) const
+    {
+        return (get_sample(i)[j / 64] >> (j % 64)) & 1ULL;
+    }
+    //DIMACS literals, the way the text output has them
+    std::vector<int> get_sample_ints(const uint64_t i) const;
+
+private:
+    void fail(const std::string& why);
+    void unmap();
+
+    std::string error;
+    const char* base = NULL;
+    size_t size = 0;
+    #ifdef _WIN32
+    std::vector<char> contents;
+    #endif
+
+    uint64_t seed = 0;
+    uint64_t num_samples = 0;
+    uint32_t num_vars = 0;
+    size_t words_per_sample = 0;
+    const uint32_t* vars = NULL;
+    const uint64_t* records = NULL;
+};
+
+#endif //SAMPLEFILE_H__
@@ -44,11 +44,14 @@
 #include <cmath>
 #include <complex>
 #include <vector>
+#include <thread>
+#include <mutex>
 
 #include "time_mem.h"
 #include "cryptominisat5/cryptominisat.h"
 #include "cryptominisat5/solvertypesmini.h"
 #include "GitSHA1.h"
+#include "sparsetable.h"
 #include "sampler.h"
 #include <approxmc/cuttingplane.h>
 
@@ -61,22 +64,23 @@ using std::vector;
 using ApproxMC::SolCount;
 using ApproxMC::CuttingPlane;
 
-Hash Sampler::add_hash(uint32_t hash_index)
+//Guards the shared logfile when several workers are sampling
+static std::mutex log_mutex;
+
+Hash Sampler::add_hash(uint32_t hash_index, SparseData& sparse_data)
 {
-    const string randomBits =
-        gen_rnd_bits(appmc->get_sampling_set().size(), hash_index);
+    const vector<uint32_t>& sampling_set = appmc->get_sampling_set();
+    const PackedBits coeffs =
+        gen_rnd_bits(sampling_set.size(), hash_index, sparse_data);
 
     vector<uint32_t> vars;
-    for (uint32_t j = 0; j < appmc->get_sampling_set().size(); j++) {
-        if (randomBits[j] == '1') {
-            vars.push_back(appmc->get_sampling_set()[j]);
-        }
-    }
+    for_each_set_bit(coeffs, [&](const size_t j) {
+        vars.push_back(sampling_set[j]);
+    });
 
-    solver->new_var();
-    const uint32_t act_var = solver->nVars()-1;
+    const uint32_t act_var = new_act_var();
     const bool rhs = gen_rhs();
-    Hash h(act_var, vars, rhs);
+    Hash h(act_var, coeffs, rhs);
 
     vars.push_back(act_var);
     solver->add_xor_clause(vars, rhs);
@@ -87,12 +91,106 @@ Hash Sampler::add_hash(uint32_t hash_index)
     return h;
 }
 
-void Sampler::ban_one(const uint32_t act_var, const vector<lbool>& model)
+uint32_t Sampler::new_act_var()
+{
+    solver->new_var();
+    act_vars.live++;
+    return solver->nVars()-1;
+}
+
+///The banning clauses all contain sol_ban_var, fixing it satisfies them
+void Sampler::retire_ban_var(const uint32_t sol_ban_var)
+{
+    vector<Lit> cl_that_removes;
+    cl_that_removes.push_back(Lit(sol_ban_var, false));
+    solver->add_clause(cl_that_removes);
+
+    act_vars.live--;
+    act_vars.dead++;
+    act_vars.total_retired++;
+}
+
+///An XOR's act_var only occurs in that XOR. As long as nobody assumes it
+///again, the XOR can be satisfied by it alone and var elimination removes both
+void Sampler::retire_hashes(map<uint64_t, Hash>& hashes)
+{
+    act_vars.live -= hashes.size();
+    act_vars.dead += hashes.size();
+    act_vars.total_retired += hashes.size();
+    hashes.clear();
+}
+
+///With --simplify 0 only the cheap clean-up of satisfied clauses is run
+///here, not the variable elimination of simplify()
+void Sampler::clean_dead_act_vars()
+{
+    if (can_rebuild_solver()) {
+        rebuild_solver();
+        return;
+    }
+    if (act_vars.dead < dead_act_vars_cleanup) {
+        return;
+    }
+
+    if (conf.verb >= 2) {
+        cout << "c [unig] cleaning " << act_vars.dead << " dead activation vars"
+        << " -- live: " << act_vars.live
+        << " total retired: " << act_vars.total_retired
+        << " nVars: " << solver->nVars() << endl;
+    }
+    solver->simplify();
+    act_vars.dead = 0;
+    fixed_may_have_grown = true;
+}
+
+bool Sampler::can_rebuild_solver() const
+{
+    if (!has_input() || act_vars.live != 0) {
+        return false;
+    }
+    if (cutting_plane != NULL && cutting_plane_rebinder_func == NULL) {
+        return false;
+    }
+    const uint32_t num_act_vars = solver->nVars() - input->num_vars;
+    return num_act_vars >= std::max(act_vars_rebuild, input->num_vars);
+}
+
+///Only between rounds, when no activation variable is live. Learnt clauses
+///are lost, the level 0 units are carried over. The cutting plane moves to
+///the new solver with the cuts it found
+void Sampler::rebuild_solver()
+{
+    if (conf.verb >= 2) {
+        cout << "c [unig] rebuilding the solver"
+        << " -- total retired: " << act_vars.total_retired
+        << " nVars: " << solver->nVars() << endl;
+    }
+
+    SATSolver* fresh = clone_solver(0);
+    if (cutting_plane != NULL) {
+        (*cutting_plane_rebinder_func)(
+            cutting_plane, fresh, cutting_plane_rebinder_data);
+    }
+    if (own_solver) {
+        delete solver;
+    }
+    solver = fresh;
+    own_solver = true;
+    delete ext_solver;
+    ext_solver = NULL;
+
+    num_fixed_separated = 0;
+    fixed_may_have_grown = true;
+    act_vars.dead = 0;
+}
+
+void Sampler::ban_one(const uint32_t act_var, const PackedBits& model)
 {
+    const vector<uint32_t>& sampling_set = appmc->get_sampling_set();
     vector<Lit> lits;
     lits.push_back(Lit(act_var, false));
-    for (const uint32_t var: appmc->get_sampling_set()) {
-        lits.push_back(Lit(var, model[var] == l_True));
+    for (uint32_t j = 0; j < sampling_set.size(); j++) {
+        lits.push_back(Lit(sampling_set[j], get_packed_bit(model, j)));
     }
     solver->add_clause(lits);
 }
@@ -102,11 +200,13 @@ void Sampler::set_cutting_plane(CuttingPlane* cutting_plane)
     this->cutting_plane = cutting_plane;
 }
 
-///adding banning clauses for repeating solutions
+///adding banning clauses for repeating solutions, the models already in
+///the cell of the first num_hashes hashes
 uint64_t Sampler::add_glob_banning_cls(
     const HashesModels* hm
     , const uint32_t act_var
-    , const uint32_t num_hashes)
+    , const uint32_t num_hashes
+    , vector<vector<lbool>>* repeats)
 {
     if (hm == NULL)
         return 0;
@@ -115,46 +215,223 @@ uint64_t Sampler::add_glob_banning_cls(
     assert(num_hashes != std::numeric_limits<uint32_t>::max());
 
     uint64_t repeat = 0;
-    vector<Lit> lits;
-    for (uint32_t i = 0; i < hm->glob_model.size(); i++) {
-        const SavedModel& sm = hm->glob_model[i];
-        //Model was generated with 'sm.hash_num' active
-        //We will have 'num_hashes' hashes active
-
-        if (sm.hash_num >= num_hashes) {
-            ban_one(act_var, sm.model);
-            repeat++;
-        } else if ((int)num_hashes - (int)sm.hash_num < 9) {
-            //Model has to fit all hashes
-            bool ok = true;
-            uint32_t checked = 0;
-            for(const auto& h: hm->hashes) {
-                //This hash is number: h.first
-                //Only has to match hashes below current need
-                //note that "h.first" is numbered from 0, so this is a "<" not "<="
-                if (h.first < num_hashes) {
-                    checked++;
-                    ok &= check_model_against_hash(h.second, sm.model);
-                    if (!ok) break;
-                }
-            }
-            if (ok) {
-                //cout << "Found repeat model, had to check " << checked << " hashes" << endl;
-                ban_one(act_var, sm.model);
-                repeat++;
+    for (auto it = hm->by_hash_prefix.lower_bound(num_hashes)
+        ; it != hm->by_hash_prefix.end()
+        ; it++
+    ) {
+        for (const uint32_t i: it->second) {
+            ban_one(act_var, hm->glob_model[i].model);
+            if (repeats) {
+                repeats->push_back(hm->glob_sols[i]);
             }
+            repeat++;
         }
     }
     return repeat;
 }
 
+///How many hashes in a row, from hash number 'from' on, the model satisfies
+uint32_t Sampler::satisfied_hash_prefix(
+    const HashesModels& hm
+    , const PackedBits& model
+    , uint32_t from)
+{
+    auto it = hm.hashes.find(from);
+    while (it != hm.hashes.end() && it->first == from
+        && check_model_against_hash(it->second, model)
+    ) {
+        from++;
+        it++;
+    }
+    return from;
+}
+
+///The model was found with the first hashCount hashes active
+void Sampler::save_model(
+    HashesModels& hm
+    , const vector<lbool>& model
+    , const uint32_t hashCount)
+{
+    const uint32_t i = hm.glob_model.size();
+    hm.glob_model.push_back(SavedModel(hashCount, pack_model(model)));
+    hm.glob_sols.push_back(model);
+    const uint32_t prefix =
+        satisfied_hash_prefix(hm, hm.glob_model[i].model, hashCount);
+    hm.by_hash_prefix[prefix].push_back(i);
+}
+
+SampleReservoir::SampleReservoir(const uint32_t num_samples) :
+    slots(num_samples)
+{
+    //The first solution fills every slot
+    for (uint32_t i = 0; i < num_samples; i++) {
+        next_replace.push(Replacement(1, i));
+    }
+}
+
+///Solution no. 'seen' replaces a slot with probability 1/seen. Hence the slot
+///survives until solution no. m with probability seen/m, and
+///floor(seen/u)+1 with u from (0,1] is where it is replaced next.
+void SampleReservoir::add(const vector<int>& solution, std::mt19937& randomEngine)
+{
+    seen++;
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    while (!next_replace.empty() && next_replace.top().first == seen) {
+        const uint32_t slot = next_replace.top().second;
+        next_replace.pop();
+        slots[slot] = solution;
+
+        const double u = 1.0 - dist(randomEngine);
+        const double next = std::floor((double)seen / u) + 1.0;
+        const uint64_t next_at = next >= (double)std::numeric_limits<uint64_t>::max() ?
+            std::numeric_limits<uint64_t>::max() : (uint64_t)next;
+        next_replace.push(Replacement(std::max(next_at, seen + 1), slot));
+    }
+}
+
+SampleSink::SampleSink(
+    UniGen::callback _func
+    , UniGen::packed_callback _packed_func
+    , void* _data
+    , const uint32_t _num_bits
+    , const uint32_t _queue_size) :
+    func(_func),
+    packed_func(_packed_func),
+    data(_data),
+    num_bits(_num_bits),
+    queue_size(_queue_size)
+{
+    if (queue_size > 0) {
+        consumer = std::thread(&SampleSink::consume, this);
+    }
+}
+
+SampleSink::~SampleSink()
+{
+    finish();
+}
+
+void SampleSink::push(const vector<int>& sample)
+{
+    if (queue_size == 0) {
+        (*func)(sample, data);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mu);
+    not_full.wait(lock, [this]{
+        return waiting.size() + waiting_packed.size() < queue_size; });
+    waiting.push_back(sample);
+    not_empty.notify_one();
+}
+
+void SampleSink::push_packed(const PackedBits& sample)
+{
+    if (queue_size == 0) {
+        (*packed_func)(sample.data(), num_bits, data);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mu);
+    not_full.wait(lock, [this]{
+        return waiting.size() + waiting_packed.size() < queue_size; });
+    waiting_packed.push_back(sample);
+    not_empty.notify_one();
+}
+
+void SampleSink::finish()
+{
+    if (!consumer.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        done = true;
+    }
+    not_empty.notify_one();
+    consumer.join();
+}
+
+void SampleSink::consume()
+{
+    //Only one of the queues is ever used, depending on the callback
+    while (true) {
+        vector<int> sample;
+        PackedBits packed;
+        bool is_packed;
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            not_empty.wait(lock, [this]{
+                return done || !waiting.empty() || !waiting_packed.empty(); });
+            is_packed = !waiting_packed.empty();
+            if (is_packed) {
+                packed = std::move(waiting_packed.front());
+                waiting_packed.pop_front();
+            } else if (!waiting.empty()) {
+                sample = std::move(waiting.front());
+                waiting.pop_front();
+            } else {
+                return;
+            }
+        }
+        not_full.notify_one();
+        if (is_packed) {
+            (*packed_func)(packed.data(), num_bits, data);
+        } else {
+            (*func)(sample, data);
+        }
+    }
+}
+
+void Sampler::emit_sample(const vector<int>& sample)
+{
+    if (packed_callback_func) {
+        pack_solution_into(sample, packed_sample);
+        emit_packed(packed_sample);
+    } else if (sink) {
+        sink->push(sample);
+    } else {
+        (*callback_func)(sample, callback_func_data);
+    }
+    if (kept_samples) {
+        kept_samples->push_back(sample);
+    }
+}
+
+//The packed callback gets the model without building its literals
+void Sampler::emit_model(const vector<lbool>& model)
+{
+    if (packed_callback_func == NULL) {
+        emit_sample(get_solution_ints(model));
+        return;
+    }
+
+    pack_model_into(model, packed_sample);
+    emit_packed(packed_sample);
+    if (kept_samples) {
+        kept_samples->push_back(get_solution_ints(model));
+    }
+}
+
+void Sampler::emit_packed(const PackedBits& sample)
+{
+    if (sink) {
+        sink->push_packed(sample);
+    } else {
+        (*packed_callback_func)(sample.data()
+            , appmc->get_sampling_set().size(), packed_callback_data);
+    }
+}
+
 SolNum Sampler::bounded_sol_count(
         uint32_t maxSolutions,
         const vector<Lit>* assumps,
         const uint32_t hashCount,
         uint32_t minSolutions,
         HashesModels* hm,
-        vector<vector<int>>* out_solutions
+        vector<vector<int>>* out_solutions,
+        SampleReservoir* reservoir
 ) {
     if (conf.verb) {
         cout << "c [unig] "
@@ -165,11 +442,13 @@ SolNum Sampler::bounded_sol_count(
         << " -- hashes active: " << hashCount << endl;
     }
 
-    //Will we need to extend the solution?
-    bool only_indep_sol = false; // true;
-    // if (out_solutions != NULL) {
-    //     only_indep_sol = false //conf.only_indep_samples;
-    // }
+    //Will we need to extend the solution? With deferred extension, only
+    //the models that are emitted are extended, by extend_model. Enumerated
+    //solutions are all kept, so they are extended right away
+    bool only_indep_sol = defers_sol_extension();
+    if (out_solutions != NULL) {
+        only_indep_sol = false;
+    }
 
     //Turn off improvement from ApproxMC4 research paper
     if (conf.force_sol_extension) {
@@ -184,8 +463,7 @@ SolNum Sampler::bounded_sol_count(
     } else {
         assert(hashCount == 0);
     }
-    solver->new_var();
-    const uint32_t sol_ban_var = solver->nVars()-1;
+    const uint32_t sol_ban_var = new_act_var();
     new_assumps.push_back(Lit(sol_ban_var, true));
 
     if (appmc->get_simplify() >= 2) {
@@ -195,6 +473,7 @@ SolNum Sampler::bounded_sol_count(
         double myTime = cpuTime();
         solver->simplify(&new_assumps);
         solver->set_verbosity(0);
+        fixed_may_have_grown = true;
         total_inter_simp_time += cpuTime() - myTime;
         if (conf.verb >= 1) {
             cout << "c [unig] inter-simp finished, total simp time: "
@@ -203,37 +482,68 @@ SolNum Sampler::bounded_sol_count(
 
     }
 
-    const uint64_t repeat = add_glob_banning_cls(hm, sol_ban_var, hashCount);
+    //Known models of the cell are counted and sampled from, not searched for
+    vector<vector<lbool>> models;
+    const uint64_t repeat =
+        add_glob_banning_cls(hm, sol_ban_var, hashCount, &models);
     uint64_t solutions = repeat;
     double last_found_time = cpuTimeTotal();
-    vector<vector<lbool>> models;
     while (solutions < maxSolutions) {
         lbool ret;
 
         if (cutting_plane != NULL) {
             int cuts = 0;
+            int fixed_cuts = 0;
+            int solves = 0;
             int delta = 0;
             do {
-                std::cout << "new_assumps: " << new_assumps << std::endl;
+                //what the solver has fixed may rule out some submatrices
+                //already, without searching for a model that shows them
+                if (fixed_separator_func != NULL && fixed_may_have_grown) {
+                    fixed_may_have_grown = false;
+                    const vector<Lit> fixed = solver->get_zero_assigned_lits();
+                    if (fixed.size() != num_fixed_separated) {
+                        num_fixed_separated = fixed.size();
+                        const int added = (*fixed_separator_func)(
+                            cutting_plane, fixed, fixed_separator_data);
+                        fixed_cuts += added;
+                        fixed_may_have_grown = added > 0;
+                    }
+                }
+
+                if (conf.verb >= 3) {
+                    cout << "new_assumps: " << new_assumps << endl;
+                }
                 ret = solver->solve(&new_assumps, false);
+                solves++;
+                if (solver->get_last_conflicts() > 0) {
+                    fixed_may_have_grown = true;
+                }
 
                 // no solutions found
                 if (ret == l_False) {
                     break;
                 }
 
-                std::cout << "Solution to separate: ";
-                const vector<lbool> model = solver->get_model();
-                for (auto solution : get_solution_ints(model)) {
-                    std::cout << solution << " ";
+                if (conf.verb >= 3) {
+                    cout << "Solution to separate: ";
+                    for (auto solution : get_solution_ints(solver->get_model())) {
+                        cout << solution << " ";
+                    }
+                    cout << "0" << endl;
                 }
-                std::cout << "0\n";
 
                 delta = cutting_plane->separate();
                 cuts += delta;
+                if (delta > 0) {
+                    fixed_may_have_grown = true;
+                }
             } while (delta != 0);
 
-            std::cout << "[cuts] Added " << cuts << " clauses" << std::endl;
+            if (conf.verb >= 2) {
+                cout << "[cuts] Added " << cuts + fixed_cuts << " clauses, "
+                << fixed_cuts << " on fixed literals, in " << solves << " solves" << endl;
+            }
         } else {
             ret = solver->solve(&new_assumps, only_indep_sol);
         }
@@ -263,7 +573,9 @@ SolNum Sampler::bounded_sol_count(
         }
 
         if (ret != l_True) {
-            std::cout << "RET != L_TRUE\n";
+            if (conf.verb >= 2) {
+                cout << "RET != L_TRUE" << endl;
+            }
             break;
         }
 
@@ -273,17 +585,26 @@ SolNum Sampler::bounded_sol_count(
         //#ifdef SLOW_DEBUG
         check_model(model, hm, hashCount);
         //#endif
-        models.push_back(model);
-        if (out_solutions) {
-            out_solutions->push_back(get_solution_ints(model));
+        if (reservoir) {
+            //Only the reservoir's picks are kept
+            if (reservoir->keeps_next()) {
+                reservoir->add(get_solution_ints(extend_model(model)), randomEngine);
+            } else {
+                reservoir->skip();
+            }
+        } else {
+            models.push_back(model);
+            if (out_solutions) {
+                out_solutions->push_back(get_solution_ints(model));
+            }
         }
 
         //ban solution
         vector<Lit> lits;
         lits.push_back(Lit(sol_ban_var, false));
         for (const uint32_t var: appmc->get_sampling_set()) {
-            assert(solver->get_model()[var] != l_Undef);
-            lits.push_back(Lit(var, solver->get_model()[var] == l_True));
+            assert(model[var] != l_Undef);
+            lits.push_back(Lit(var, model[var] == l_True));
         }
         if (conf.verb_banning_cls) {
             cout << "c [unig] Adding banning clause: " << lits << endl;
@@ -291,8 +612,10 @@ SolNum Sampler::bounded_sol_count(
         solver->add_clause(lits);
     }
 
-    if (solutions < maxSolutions) {
-        std::cout << "Solutions < maxSolutions" << std::endl;
+    if (solutions < maxSolutions && reservoir == NULL) {
+        if (conf.verb >= 2) {
+            cout << "Solutions < maxSolutions" << endl;
+        }
         //Sampling -- output a random sample of N solutions
         if (solutions >= minSolutions) {
             assert(minSolutions > 0);
@@ -300,26 +623,37 @@ SolNum Sampler::bounded_sol_count(
             for (uint32_t i = 0; i < models.size(); i++) {
                 modelIndices.push_back(i);
             }
+            //The order the solver found them in depends on its learnt
+            //clauses, the cell itself only on the hashes
+            const vector<uint32_t>& sampling_set = appmc->get_sampling_set();
+            std::sort(modelIndices.begin(), modelIndices.end(),
+                [&](const size_t a, const size_t b) {
+                    for (const uint32_t var: sampling_set) {
+                        const uint8_t va = models[a][var].getValue();
+                        const uint8_t vb = models[b][var].getValue();
+                        if (va != vb) {
+                            return va < vb;
+                        }
+                    }
+                    return false;
+                });
             std::shuffle(modelIndices.begin(), modelIndices.end(), randomEngine);
 
             for (uint32_t i = 0; i < sols_to_return(solutions); i++) {
-                const auto& model = models.at(modelIndices.at(i));
-                (*callback_func)(get_solution_ints(model), callback_func_data);
+                emit_model(extend_model(models.at(modelIndices.at(i))));
             }
         }
     }
 
     //Save global models
     if (hm && appmc->get_reuse_models()) {
-        for (const auto& model: models) {
-            hm->glob_model.push_back(SavedModel(hashCount, model));
+        for (size_t i = repeat; i < models.size(); i++) {
+            save_model(*hm, models[i], hashCount);
         }
     }
 
     //Remove solution banning
-    vector<Lit> cl_that_removes;
-    cl_that_removes.push_back(Lit(sol_ban_var, false));
-    solver->add_clause(cl_that_removes);
+    retire_ban_var(sol_ban_var);
 
     return SolNum(solutions, repeat);
 }
@@ -366,16 +700,34 @@ vector<vector<int>> Sampler::sample(
 
 vector<Lit> Sampler::set_num_hashes(
     uint32_t num_wanted,
-    map<uint64_t, Hash>& hashes
+    HashesModels& hm,
+    SparseData& sparse_data
 ) {
+    map<uint64_t, Hash>& hashes = hm.hashes;
     vector<Lit> assumps;
     for(uint32_t i = 0; i < num_wanted; i++) {
         if (hashes.find(i) != hashes.end()) {
             assumps.push_back(Lit(hashes[i].act_var, true));
         } else {
-            Hash h = add_hash(i);
+            Hash h = add_hash(i, sparse_data);
             assumps.push_back(Lit(h.act_var, true));
             hashes[i] = h;
+
+            //Only the models satisfying every earlier hash can move up
+            auto it = hm.by_hash_prefix.find(i);
+            if (it != hm.by_hash_prefix.end()) {
+                vector<uint32_t> stay;
+                for (const uint32_t m: it->second) {
+                    const uint32_t prefix =
+                        satisfied_hash_prefix(hm, hm.glob_model[m].model, i);
+                    if (prefix == i) {
+                        stay.push_back(m);
+                    } else {
+                        hm.by_hash_prefix[prefix].push_back(m);
+                    }
+                }
+                it->second.swap(stay);
+            }
         }
     }
     assert(num_wanted == assumps.size());
@@ -398,6 +750,8 @@ void Sampler::simplify()
     solver->set_scc(1);
 
     solver->simplify();
+    act_vars.dead = 0;
+    fixed_may_have_grown = true;
 
     solver->set_sls(0);
     solver->set_intree_probe(0);
@@ -410,8 +764,23 @@ void Sampler::simplify()
 
 vector<vector<int>> Sampler::generate_samples(const uint32_t num_samples_needed)
 {
+    //Outside the ideal case only the accepted samples are kept, and not
+    //even those when they only go to the callback
     vector<vector<int> > out_solutions;
-    
+    //rebuild_solver() may replace it while sampling
+    SATSolver* const appmc_solver = solver;
+    void* const sink_data =
+        packed_callback_func ? packed_callback_data : callback_func_data;
+    SampleSink samples_sink(callback_func, packed_callback_func, sink_data
+        , appmc->get_sampling_set().size(), conf.sink_queue);
+    sink = &samples_sink;
+    if (packed_callback_func && packed_setup_func) {
+        (*packed_setup_func)(appmc->get_sampling_set(), packed_callback_data);
+    }
+    if (conf.startiter > 0 && !conf.sink_only) {
+        kept_samples = &out_solutions;
+    }
+
     double genStartTime = cpuTimeTotal();
 
     hiThresh = ceil(1 + (1.4142136 * (1 + conf.kappa) * threshold_Samplergen));
@@ -431,6 +800,12 @@ vector<vector<int>> Sampler::generate_samples(const uint32_t num_samples_needed)
     callsPerLoop = std::max(callsPerLoop, 1U);
     //cout << "c [unig] callsPerLoop:" << callsPerLoop << endl;
 
+    const int sparse_table_no = find_best_sparse_match();
+    if (conf.verb && sparse_table_no != -1) {
+        cout << "c [unig] using sparse hashes, table for sampling sets up to "
+        << get_sparse_table().vars_to_inclusive[sparse_table_no] << " vars" << endl;
+    }
+
     if (conf.verb) {
         cout << "c [unig] starting sample generation."
         << " loThresh: " << loThresh
@@ -439,15 +814,58 @@ vector<vector<int>> Sampler::generate_samples(const uint32_t num_samples_needed)
     }
 
     uint32_t samples = 0;
-    if (conf.startiter > 0) {
+    bool parallel = conf.num_threads > 1;
+    if (parallel && cutting_plane != NULL && cutting_plane_factory_func == NULL) {
+        cout << "c [unig] WARNING: cutting plane has no factory for worker solvers,"
+        << " sampling with 1 thread" << endl;
+        parallel = false;
+    }
+    if (parallel && !has_input()) {
+        cout << "c [unig] WARNING: the input formula was not recorded,"
+        << " sampling with 1 thread" << endl;
+        parallel = false;
+    }
+    if (conf.defer_sol_extension == 2 && !has_input()) {
+        cout << "c [unig] WARNING: the input formula was not recorded,"
+        << " extending models on the sampling solver" << endl;
+    }
+
+    if (conf.startiter > 0 && parallel) {
+        samples = generate_samples_parallel(
+            num_samples_needed,
+            callsNeeded);
+    } else if (conf.startiter > 0) {
         std::cout << "conf.startiter > 0\n"; 
         uint32_t lastSuccessfulHashOffset = 0;
         while(samples < num_samples_needed) {
             samples += gen_n_samples(
                 callsPerLoop,
                 &lastSuccessfulHashOffset,
-                num_samples_needed,
-                &out_solutions);
+                num_samples_needed);
+        }
+    } else if (conf.reservoir) {
+        /* Ideal sampling case; stream all solutions through a reservoir */
+        SampleReservoir reservoir(num_samples_needed);
+        const uint32_t count = bounded_sol_count(
+            std::numeric_limits<uint32_t>::max() //max no. solutions
+            , NULL //assumps is empty
+            , 0 //number of hashes (information only)
+            , 1 //min num. solutions
+            , NULL //gobal model (would be banned)
+            , NULL //solutions are not kept
+            , &reservoir
+        ).solutions;
+        assert(count > 0);
+        if (conf.verb) {
+            cout << "c [unig] Streamed " << count << " solutions through the reservoir" << endl;
+        }
+
+        for (const auto& sol: reservoir.get_samples()) {
+            samples++;
+            emit_sample(sol);
+            if (!conf.sink_only) {
+                out_solutions.push_back(sol);
+            }
         }
     } else {
         std::cout << "ELSE\n"; 
@@ -464,16 +882,33 @@ vector<vector<int>> Sampler::generate_samples(const uint32_t num_samples_needed)
 
         std::uniform_int_distribution<unsigned> uid {0, count-1};
         for (uint32_t i = 0; i < num_samples_needed; ++i) {
-            auto it = out_solutions.begin();
-            for (uint32_t j = uid(randomEngine); j > 0; --j)    // TODO improve hack
-            {
-                ++it;
-            }
             samples++;
-            (*callback_func)(*it, callback_func_data);
+            emit_sample(out_solutions[uid(randomEngine)]);
+        }
+        if (conf.sink_only) {
+            out_solutions.clear();
         }
     }
 
+    samples_sink.finish();
+    sink = NULL;
+    kept_samples = NULL;
+    delete ext_solver;
+    ext_solver = NULL;
+    if (own_solver) {
+        if (cutting_plane != NULL) {
+            (*cutting_plane_rebinder_func)(
+                cutting_plane, appmc_solver, cutting_plane_rebinder_data);
+        }
+        delete solver;
+        own_solver = false;
+    }
+    solver = appmc_solver;
+    if (conf.verb && defers_sol_extension()) {
+        cout << "c [unig] Deferred solution extension extended "
+        << num_extended << " models" << endl;
+    }
+
     cout
     << "c [unig] Time to sample: "
     << cpuTimeTotal() - genStartTime
@@ -486,16 +921,206 @@ vector<vector<int>> Sampler::generate_samples(const uint32_t num_samples_needed)
     return out_solutions;
 }
 
+static void collect_sample(const vector<int>& solution, void* data)
+{
+    ((vector<vector<int>>*)data)->push_back(solution);
+}
+
+static void collect_packed_sample(const uint64_t* bits, uint32_t num_bits, void* data)
+{
+    ((vector<PackedBits>*)data)->push_back(
+        PackedBits(bits, bits + packed_words(num_bits)));
+}
+
+SATSolver* Sampler::clone_solver(const uint32_t thread_num) const
+{
+    SATSolver* s = new SATSolver;
+    s->set_verbosity(0);
+    s->set_seed(appmc->get_seed() + thread_num);
+    s->new_vars(input->num_vars);
+
+    //The input formula, learnt clauses are re-derived by each worker.
+    //Activation variables all come after it and are not copied
+    assert(has_input());
+    for (const auto& cl: input->clauses) {
+        s->add_clause(cl);
+    }
+    for (const auto& x: input->xors) {
+        s->add_xor_clause(x.first, x.second);
+    }
+
+    //Implied by the formula and the cuts, saves re-deriving them
+    for (const Lit lit: solver->get_zero_assigned_lits()) {
+        if (lit.var() < input->num_vars) {
+            s->add_clause(vector<Lit>{lit});
+        }
+    }
+
+    return s;
+}
+
+//Completes a model solved on the sampling set only. Both the sampling
+//solver, which extends through its own elimination and replacement records,
+//and the copy, built from the input formula, only give models of the input
+vector<lbool> Sampler::extend_model(const vector<lbool>& model)
+{
+    if (conf.only_indep_samples || !defers_sol_extension()) {
+        return model;
+    }
+
+    SATSolver* s = solver;
+    if (conf.defer_sol_extension == 2 && has_input()) {
+        if (ext_solver == NULL) {
+            ext_solver = clone_solver(conf.num_threads + 1);
+        }
+        s = ext_solver;
+    }
+
+    vector<Lit> assumps;
+    for (const uint32_t var: appmc->get_sampling_set()) {
+        assert(model[var] != l_Undef);
+        assumps.push_back(Lit(var, model[var] == l_False));
+    }
+    const lbool ret = s->solve(&assumps, false);
+    if (ret != l_True) {
+        cout << "ERROR! Could not extend a model of the sampling set" << endl;
+        exit(-1);
+    }
+    num_extended++;
+    return s->get_model();
+}
+
+uint32_t Sampler::generate_samples_parallel(
+    const uint32_t num_samples_needed
+    , const uint32_t callsNeeded)
+{
+    const uint32_t num_workers = std::min(conf.num_threads, callsNeeded);
+    if (conf.verb) {
+        cout << "c [unig] sampling with " << num_workers << " threads,"
+        << " calls needed: " << callsNeeded << endl;
+    }
+
+    //Every worker gets its own solver, cutting plane and hashes
+    vector<Sampler> workers(num_workers, *this);
+    for (uint32_t t = 0; t < num_workers; t++) {
+        Sampler& w = workers[t];
+        w.solver = clone_solver(t+1);
+        w.sink = NULL;
+        w.kept_samples = NULL;
+        w.callback_func = collect_sample;
+        if (packed_callback_func) {
+            w.packed_callback_func = collect_packed_sample;
+        }
+        w.own_solver = true;
+        w.ext_solver = NULL;
+        w.num_extended = 0;
+        if (cutting_plane != NULL) {
+            w.cutting_plane = (*cutting_plane_factory_func)(
+                w.solver, cutting_plane_factory_data);
+            w.num_fixed_separated = 0;
+            w.fixed_may_have_grown = true;
+        }
+    }
+
+    SampleWorkQueue queue(callsNeeded, this);
+    vector<std::thread> threads;
+    for (uint32_t t = 0; t < num_workers; t++) {
+        threads.push_back(std::thread(
+            &Sampler::sample_worker, &workers[t]
+            , &queue, num_samples_needed));
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    assert(queue.next_to_emit == callsNeeded);
+
+    for (auto& w: workers) {
+        delete w.solver;
+        delete w.ext_solver;
+        num_extended += w.num_extended;
+    }
+
+    return queue.samples;
+}
+
+void Sampler::sample_worker(
+    SampleWorkQueue* queue
+    , const uint32_t num_samples_needed)
+{
+    //Samples are collected into the batch, only emit_in_order passes them on
+    while (true) {
+        uint32_t call;
+        {
+            std::lock_guard<std::mutex> lock(queue->mu);
+            if (queue->next_call == queue->calls_needed) {
+                break;
+            }
+            call = queue->next_call++;
+        }
+
+        //Every call starts from the seed and hash count alone, whichever
+        //worker takes it, so the samples depend on the seed but not on
+        //the scheduling
+        randomEngine.seed(appmc->get_seed() + call + 1);
+        uint32_t lastSuccessfulHashOffset = 0;
+
+        SampleBatch batch;
+        callback_func_data = &batch.samples;
+        packed_callback_data = &batch.packed;
+        //emit_model only keeps the int form of the packed samples, the
+        //unpacked ones the owner keeps itself in emit_sample
+        kept_samples = NULL;
+        if (packed_callback_func && queue->owner->kept_samples) {
+            kept_samples = &batch.kept;
+        }
+        batch.num_samples = gen_n_samples(
+            1,
+            &lastSuccessfulHashOffset,
+            num_samples_needed);
+        emit_in_order(queue, call, batch);
+    }
+}
+
+//Hands batches to the callback strictly by call number, so the sample order
+//does not depend on which worker finished first
+void Sampler::emit_in_order(
+    SampleWorkQueue* queue
+    , const uint32_t call
+    , SampleBatch& batch)
+{
+    std::lock_guard<std::mutex> lock(queue->mu);
+    queue->finished[call] = std::move(batch);
+
+    auto it = queue->finished.find(queue->next_to_emit);
+    while (it != queue->finished.end()) {
+        SampleBatch& b = it->second;
+        for (const auto& sol: b.samples) {
+            queue->owner->emit_sample(sol);
+        }
+        for (const auto& sol: b.packed) {
+            queue->owner->emit_packed(sol);
+        }
+        if (queue->owner->kept_samples) {
+            vector<vector<int>>& kept = *queue->owner->kept_samples;
+            kept.insert(kept.end(), b.kept.begin(), b.kept.end());
+        }
+        queue->samples += b.num_samples;
+        queue->finished.erase(it);
+        queue->next_to_emit++;
+        it = queue->finished.find(queue->next_to_emit);
+    }
+}
+
 uint32_t Sampler::gen_n_samples(
     const uint32_t num_calls
     , uint32_t* lastSuccessfulHashOffset
-    , const uint32_t num_samples_needed
-    , vector<vector<int>>* out_solutions)
+    , const uint32_t num_samples_needed)
 {
-    SparseData sparse_data(-1);
     uint32_t num_samples = 0;
     uint32_t i = 0;
     while(i < num_calls) {
+        //Fresh hashes every round, so the density starts over as well
+        SparseData sparse_data(find_best_sparse_match());
         uint32_t hashOffsets[3];
         hashOffsets[0] = *lastSuccessfulHashOffset;
 
@@ -509,27 +1134,30 @@ uint32_t Sampler::gen_n_samples(
             hashOffsets[2] = 0;
         }
 
-        map<uint64_t, Hash> hashes;
+        //The cells of a round are nested, so the models found at one hash
+        //count are reused at the others
+        HashesModels hm;
         bool ok;
         for (uint32_t j = 0; j < 3; j++) {
             uint32_t currentHashOffset = hashOffsets[j];
             uint32_t currentHashCount = currentHashOffset + conf.startiter;
-            const vector<Lit> assumps = set_num_hashes(currentHashCount, hashes);
+            const vector<Lit> assumps =
+                set_num_hashes(currentHashCount, hm, sparse_data);
 
             double myTime = cpuTime();
-            const uint64_t solutionCount = bounded_sol_count(
+            const SolNum sols = bounded_sol_count(
                 hiThresh // max num solutions
                 , &assumps //assumptions to use
                 , currentHashCount
                 , loThresh //min number of solutions (samples not output otherwise)
-                , NULL
-                , out_solutions
-            ).solutions;
+                , &hm
+            );
+            const uint64_t solutionCount = sols.solutions;
             ok = (solutionCount < hiThresh && solutionCount >= loThresh);
             write_log(
                 true, //sampling
                 i, currentHashCount, solutionCount == hiThresh,
-                      solutionCount, 0, cpuTime()-myTime);
+                      solutionCount, sols.repeated, cpuTime()-myTime);
 
             if (ok) {
                 num_samples += sols_to_return(num_samples_needed);
@@ -555,9 +1183,13 @@ uint32_t Sampler::gen_n_samples(
         if (ok) {
             i++;
         }
+
+        //These hashes are never assumed again
+        retire_hashes(hm.hashes);
         if (appmc->get_simplify() >= 1) {
             simplify();
         }
+        clean_dead_act_vars();
     }
     return num_samples;
 }
@@ -592,21 +1224,125 @@ bool Sampler::gen_rhs()
     return rhs;
 }
 
-string Sampler::gen_rnd_bits(
+static SparseTable parse_sparse_table(const char* text)
+{
+    SparseTable table;
+    std::istringstream in(text);
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        string field;
+        if (!std::getline(fields, field, ',') || field.empty()) {
+            continue;
+        }
+
+        if (field == "header") {
+            while (std::getline(fields, field, ',')) {
+                if (!field.empty()) {
+                    table.probval.push_back(std::stod(field));
+                }
+            }
+        } else {
+            table.vars_to_inclusive.push_back(std::stoul(field));
+            vector<uint32_t> index_var_map;
+            while (std::getline(fields, field, ',')) {
+                if (!field.empty()) {
+                    index_var_map.push_back(std::stoul(field));
+                }
+            }
+            table.index_var_map.push_back(index_var_map);
+        }
+    }
+    return table;
+}
+
+const SparseTable& Sampler::get_sparse_table()
+{
+    static const SparseTable table = parse_sparse_table(get_sparseval_table());
+    return table;
+}
+
+///Row of the sparse table to use for our sampling set, -1 for dense hashes.
+///Dense unless asked for, the uniformity guarantee only holds for those
+int Sampler::find_best_sparse_match()
+{
+    if (!conf.sparse_sampling || !appmc->get_sparse()) {
+        return -1;
+    }
+
+    const SparseTable& table = get_sparse_table();
+    for (uint32_t i = 0; i < table.vars_to_inclusive.size(); i++) {
+        if (table.vars_to_inclusive[i] >= appmc->get_sampling_set().size()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//64 bits, each set with probability cutoff/1024. The bits of cutoff are
+//consumed from the lowest set one up: OR-ing in a fresh random word for a 1
+//and AND-ing one in for a 0 yields exactly that probability.
+uint64_t Sampler::gen_rnd_word(const uint32_t cutoff)
+{
+    if (cutoff == 0) {
+        return 0;
+    }
+    if (cutoff >= 1024) {
+        return ~0ULL;
+    }
+
+    uint32_t bit = 0;
+    while (!((cutoff >> bit) & 1U)) {
+        bit++;
+    }
+
+    uint64_t word = 0;
+    for (; bit < 10; bit++) {
+        const uint64_t hi = randomEngine();
+        const uint64_t rnd = (hi << 32) | (uint64_t)randomEngine();
+        if ((cutoff >> bit) & 1U) {
+            word |= rnd;
+        } else {
+            word &= rnd;
+        }
+    }
+    return word;
+}
+
+//Bits are drawn a whole word at a time. Dense hashes use probability 1/2,
+//sparse ones lower it as the hash index grows, following the sparse table.
+PackedBits Sampler::gen_rnd_bits(
     const uint32_t size,
-    const uint32_t /*hash_index*/)
+    const uint32_t hash_index,
+    SparseData& sparse_data)
 {
-    string randomBits;
-    std::uniform_int_distribution<uint32_t> dist{0, 1000};
-    uint32_t cutoff = 500;
+    if (sparse_data.table_no != -1) {
+        const SparseTable& table = get_sparse_table();
+        const vector<uint32_t>& index_var_map =
+            table.index_var_map[sparse_data.table_no];
+
+        //Do we need to update the probability?
+        while (sparse_data.next_index < index_var_map.size()
+            && sparse_data.next_index < table.probval.size()
+            && hash_index >= index_var_map[sparse_data.next_index]
+        ) {
+            sparse_data.sparseprob = table.probval[sparse_data.next_index];
+            sparse_data.next_index++;
+        }
+        assert(sparse_data.sparseprob <= 0.5);
+    }
+    const uint32_t cutoff = std::round(sparse_data.sparseprob * 1024.0);
 
-    while (randomBits.size() < size) {
-        bool val = dist(randomEngine) < cutoff;
-        randomBits += '0' + val;
+    PackedBits randomBits(packed_words(size));
+    for (uint64_t& word: randomBits) {
+        word = gen_rnd_word(cutoff);
+    }
+
+    //Bits past the sampling set must stay clear
+    if (size % 64 != 0) {
+        randomBits.back() &= (1ULL << (size % 64)) - 1;
     }
-    assert(randomBits.size() >= size);
 
-    //cout << "rnd bits: " << randomBits << endl;
     return randomBits;
 }
 
@@ -674,6 +1410,7 @@ void Sampler::write_log(
 )
 {
     if (conf.logfile) {
+        std::lock_guard<std::mutex> lock(log_mutex);
         *conf.logfile
         << std::left
         << std::setw(5) << (int)sampling
@@ -702,6 +1439,7 @@ void Sampler::check_model(
     if (!hm)
         return;
 
+    const PackedBits packed = pack_model(model);
     uint32_t checked = 0;
     bool ok = true;
     for(const auto& h: hm->hashes) {
@@ -711,20 +1449,53 @@ void Sampler::check_model(
         if (h.first < hashCount) {
             //cout << "Checking model against hash" << h.first << endl;
             checked++;
-            ok &= check_model_against_hash(h.second, model);
+            ok &= check_model_against_hash(h.second, packed);
             if (!ok) break;
         }
     }
     assert(ok);
 }
 
-bool Sampler::check_model_against_hash(const Hash& h, const vector<lbool>& model)
+PackedBits Sampler::pack_model(const vector<lbool>& model) const
 {
-    bool rhs = h.rhs;
-    for (const uint32_t var: h.hash_vars) {
-        assert(model[var] != l_Undef);
-        rhs ^= model[var] == l_True;
+    PackedBits packed;
+    pack_model_into(model, packed);
+    return packed;
+}
+
+//Re-uses the memory of packed
+void Sampler::pack_model_into(const vector<lbool>& model, PackedBits& packed) const
+{
+    const vector<uint32_t>& sampling_set = appmc->get_sampling_set();
+    packed.assign(packed_words(sampling_set.size()), 0);
+    for (uint32_t j = 0; j < sampling_set.size(); j++) {
+        assert(model[sampling_set[j]] != l_Undef);
+        if (model[sampling_set[j]] == l_True) {
+            set_packed_bit(packed, j);
+        }
     }
+}
+
+//Inverse of get_solution_ints, projected to the sampling set
+void Sampler::pack_solution_into(const vector<int>& solution, PackedBits& packed) const
+{
+    const vector<uint32_t>& sampling_set = appmc->get_sampling_set();
+    packed.assign(packed_words(sampling_set.size()), 0);
+    for (uint32_t j = 0; j < sampling_set.size(); j++) {
+        const int lit = conf.only_indep_samples ?
+            solution[j] : solution[sampling_set[j]];
+        assert(std::abs(lit) == (int)sampling_set[j] + 1);
+        if (lit > 0) {
+            set_packed_bit(packed, j);
+        }
+    }
+}
+
+bool Sampler::check_model_against_hash(const Hash& h, const PackedBits& model)
+{
+    assert(h.coeffs.size() == model.size());
+    bool rhs = h.rhs;
+    rhs ^= and_parity(h.coeffs.data(), model.data(), model.size());
 
     //If we started with rhs=FALSE and we XOR-ed in only FALSE
     //rhs is FALSE but we should return TRUE
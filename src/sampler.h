@@ -36,10 +36,15 @@ Sampler
 #include <map>
 #include <cstdint>
 #include <mutex>
+#include <queue>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 #include <cryptominisat5/cryptominisat.h>
 #include <approxmc/approxmc.h>
 #include "unigen/unigen.h"
 #include "config.h"
+#include "packedbits.h"
 #include <approxmc/cuttingplane.h>
 
 using std::string;
@@ -52,22 +57,23 @@ using namespace CMSat;
 using namespace ApproxMC;
 using ApproxMC::CuttingPlane;
 
+//Model projected to the sampling set
 struct SavedModel
 {
-    SavedModel(uint32_t _hash_num, const vector<lbool>& _model) :
+    SavedModel(uint32_t _hash_num, const PackedBits& _model) :
         model(_model),
         hash_num(_hash_num)
     {
     }
 
-    vector<lbool> model;
+    PackedBits model;
     uint32_t hash_num;
 };
 
 struct Hash {
-    Hash(uint32_t _act_var, vector<uint32_t>& _hash_vars, bool _rhs) :
+    Hash(uint32_t _act_var, const PackedBits& _coeffs, bool _rhs) :
         act_var(_act_var),
-        hash_vars(_hash_vars),
+        coeffs(_coeffs),
         rhs(_rhs)
     {}
 
@@ -75,13 +81,115 @@ struct Hash {
     {}
 
     uint32_t act_var;
-    vector<uint32_t> hash_vars;
+    PackedBits coeffs; //over the sampling set
     bool rhs;
 };
 
 struct HashesModels {
     map<uint64_t, Hash> hashes;
     vector<SavedModel> glob_model; //global table storing models
+    vector<vector<lbool>> glob_sols; //the solver's models, same order, to emit
+    //glob_model indices by how many hashes in a row, from hash 0 on, the
+    //model's parities satisfy. The cell of the first k hashes holds the
+    //models under keys k and up
+    map<uint32_t, vector<uint32_t>> by_hash_prefix;
+};
+
+//The formula as it was given, before the solver simplified it. The solvers
+//of the workers are built from it: the solver's own clauses leave out what
+//variable replacement and elimination took away
+struct InputFormula {
+    uint32_t num_vars = 0;
+    vector<vector<Lit>> clauses;
+    vector<std::pair<vector<uint32_t>, bool>> xors;
+};
+
+//Lifecycle of the activation variables of hashes and banning clauses.
+//A retired variable is never assumed again, so whatever it switches on
+//(an XOR, a set of banning clauses) is dead and the solver may drop it
+struct ActVars {
+    uint32_t live = 0;
+    uint32_t dead = 0; //retired since the last clean-up
+    uint64_t total_retired = 0;
+};
+
+//Number of retired activation variables after which the solver is
+//simplified to get rid of them
+constexpr uint32_t dead_act_vars_cleanup = 64;
+
+//A retired activation variable cannot be handed out again: its XOR or unit
+//is still in the solver. Once there are this many activation variables, and
+//at least as many as input variables, the solver is built anew from the
+//input formula, which gives their numbers back
+constexpr uint32_t act_vars_rebuild = 4096;
+
+//Uniform samples, with replacement, from a stream of solutions of unknown
+//length while keeping only num_samples of them. Every slot is a size-1
+//reservoir; instead of a coin flip per slot for every solution, each slot
+//draws the number of the next solution that will replace it.
+class SampleReservoir {
+public:
+    explicit SampleReservoir(const uint32_t num_samples);
+
+    //Will the next solution land in any slot? If not, it need not be built
+    bool keeps_next() const
+    {
+        return !next_replace.empty() && next_replace.top().first == seen + 1;
+    }
+    void add(const vector<int>& solution, std::mt19937& randomEngine);
+    void skip()
+    {
+        seen++;
+    }
+
+    const vector<vector<int>>& get_samples() const
+    {
+        return slots;
+    }
+
+private:
+    typedef std::pair<uint64_t, uint32_t> Replacement; //solution no., slot
+    uint64_t seen = 0;
+    vector<vector<int>> slots;
+    std::priority_queue<Replacement, vector<Replacement>,
+        std::greater<Replacement>> next_replace;
+};
+
+//Where accepted samples go. Without a queue the callback is called right
+//away; with one, it runs on its own thread and the sampler blocks while
+//queue_size samples are waiting, so a slow consumer slows sampling down
+//instead of piling up samples in memory
+class SampleSink {
+public:
+    SampleSink(
+        UniGen::callback func
+        , UniGen::packed_callback packed_func
+        , void* data
+        , const uint32_t num_bits
+        , const uint32_t queue_size);
+    ~SampleSink();
+
+    void push(const vector<int>& sample);
+    void push_packed(const PackedBits& sample);
+    //Waits until the callback has seen every sample pushed
+    void finish();
+
+private:
+    void consume();
+
+    UniGen::callback func;
+    UniGen::packed_callback packed_func;
+    void* data;
+    const uint32_t num_bits; //of packed samples
+    const uint32_t queue_size;
+
+    std::mutex mu;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<vector<int>> waiting;
+    std::deque<PackedBits> waiting_packed;
+    bool done = false;
+    std::thread consumer;
 };
 
 struct SolNum {
@@ -93,6 +201,43 @@ struct SolNum {
     uint64_t repeated = 0;
 };
 
+//One finished gen_n_samples call of a worker, held until its turn to be
+//handed to the callback
+struct SampleBatch {
+    uint32_t num_samples = 0;
+    vector<vector<int>> samples;
+    vector<PackedBits> packed;
+    vector<vector<int>> kept; //int form of packed, when sample() returns them
+};
+
+class Sampler;
+
+//Shared between the sampling workers: hands out the calls to gen_n_samples
+//and re-orders the finished batches by call number
+struct SampleWorkQueue {
+    SampleWorkQueue(uint32_t _calls_needed, Sampler* _owner) :
+        calls_needed(_calls_needed),
+        owner(_owner)
+    {}
+
+    std::mutex mu;
+    const uint32_t calls_needed;
+    Sampler* const owner; //emits the samples, in order
+    uint32_t next_call = 0;
+    uint32_t next_to_emit = 0;
+    uint32_t samples = 0;
+    map<uint32_t, SampleBatch> finished;
+};
+
+//Parsed sparseval.txt. Row i applies to sampling sets of at most
+//vars_to_inclusive[i] variables; from hash index index_var_map[i][j] on,
+//the XORs are built with probability probval[j]
+struct SparseTable {
+    vector<double> probval;
+    vector<uint32_t> vars_to_inclusive;
+    vector<vector<uint32_t>> index_var_map;
+};
+
 struct SparseData {
     explicit SparseData(int _table_no) :
         table_no(_table_no)
@@ -117,6 +262,24 @@ public:
     ///What to call on samples
     UniGen::callback callback_func = NULL;
     void* callback_func_data = NULL;
+    UniGen::packed_callback packed_callback_func = NULL;
+    UniGen::packed_setup packed_setup_func = NULL;
+    void* packed_callback_data = NULL;
+
+    ///How to get a cutting plane for a worker's solver
+    UniGen::cutting_plane_factory cutting_plane_factory_func = NULL;
+    void* cutting_plane_factory_data = NULL;
+
+    ///How to move a cutting plane to a rebuilt solver, NULL for no rebuilds
+    UniGen::cutting_plane_rebinder cutting_plane_rebinder_func = NULL;
+    void* cutting_plane_rebinder_data = NULL;
+
+    ///What worker solvers are built from, NULL or empty if not recorded
+    const InputFormula* input = NULL;
+
+    ///What to check the literals fixed at level 0 with, NULL for nothing
+    UniGen::fixed_separator fixed_separator_func = NULL;
+    void* fixed_separator_data = NULL;
 
 private:
     uint32_t loThresh;
@@ -124,8 +287,12 @@ private:
     uint32_t threshold_Samplergen;
 
     Config conf;
-    string gen_rnd_bits(const uint32_t size,
-                        const uint32_t numhashes);
+    PackedBits gen_rnd_bits(const uint32_t size,
+                        const uint32_t numhashes,
+                        SparseData& sparse_data);
+    uint64_t gen_rnd_word(const uint32_t cutoff);
+    static const SparseTable& get_sparse_table();
+    int find_best_sparse_match();
     uint32_t sols_to_return(uint32_t numSolutions);
     void add_Sampler_options();
     bool gen_rhs();
@@ -133,22 +300,68 @@ private:
         const uint32_t samples
         , uint32_t* lastSuccessfulHashOffset
         , const uint32_t num_samples_needed
-        , vector<vector<int>>* out_solutions = NULL
     );
-    Hash add_hash(uint32_t total_num_hashes);
+    Hash add_hash(uint32_t total_num_hashes, SparseData& sparse_data);
+    uint32_t new_act_var();
+    void retire_ban_var(const uint32_t sol_ban_var);
+    void retire_hashes(map<uint64_t, Hash>& hashes);
+    void clean_dead_act_vars();
+    bool can_rebuild_solver() const;
+    void rebuild_solver();
     string binary(const uint32_t x, const uint32_t length);
     vector<vector<int>> generate_samples(const uint32_t num_samples);
+    uint32_t generate_samples_parallel(
+        const uint32_t num_samples_needed
+        , const uint32_t callsNeeded
+    );
+    void sample_worker(
+        SampleWorkQueue* queue
+        , const uint32_t num_samples_needed
+    );
+    void emit_in_order(
+        SampleWorkQueue* queue
+        , const uint32_t call
+        , SampleBatch& batch
+    );
+    void emit_sample(const vector<int>& sample);
+    void emit_model(const vector<lbool>& model);
+    void emit_packed(const PackedBits& sample);
+    bool has_input() const
+    {
+        return input != NULL && input->num_vars > 0;
+    }
+    SATSolver* clone_solver(const uint32_t thread_num) const;
+    vector<lbool> extend_model(const vector<lbool>& model);
+    //Are models solved on the sampling set only? Separating cuts needs
+    //the whole model, so not with a cutting plane
+    bool defers_sol_extension() const
+    {
+        return conf.defer_sol_extension != 0 && !conf.force_sol_extension
+            && cutting_plane == NULL;
+    }
     SolNum bounded_sol_count(
         uint32_t maxSolutions,
         const vector<Lit>* assumps,
         const uint32_t hashCount,
         uint32_t minSolutions = 1,
         HashesModels* hm = NULL,
-        vector<vector<int>>* out_solutions = NULL
+        vector<vector<int>>* out_solutions = NULL,
+        SampleReservoir* reservoir = NULL
     );
     vector<Lit> set_num_hashes(
         uint32_t num_wanted,
-        map<uint64_t, Hash>& hashes
+        HashesModels& hm,
+        SparseData& sparse_data
+    );
+    uint32_t satisfied_hash_prefix(
+        const HashesModels& hm,
+        const PackedBits& model,
+        uint32_t from
+    );
+    void save_model(
+        HashesModels& hm,
+        const vector<lbool>& model,
+        const uint32_t hashCount
     );
     void simplify();
 
@@ -168,17 +381,21 @@ private:
     );
     void openLogFile();
     void call_after_parse();
-    void ban_one(const uint32_t act_var, const vector<lbool>& model);
+    PackedBits pack_model(const vector<lbool>& model) const;
+    void pack_model_into(const vector<lbool>& model, PackedBits& packed) const;
+    void pack_solution_into(const vector<int>& solution, PackedBits& packed) const;
+    void ban_one(const uint32_t act_var, const PackedBits& model);
     void check_model(
         const vector<lbool>& model,
         const HashesModels* const hm,
         const uint32_t hashCount
     );
-    bool check_model_against_hash(const Hash& h, const vector<lbool>& model);
+    bool check_model_against_hash(const Hash& h, const PackedBits& model);
     uint64_t add_glob_banning_cls(
         const HashesModels* glob_model = NULL
         , const uint32_t act_var = std::numeric_limits<uint32_t>::max()
         , const uint32_t num_hashes = std::numeric_limits<uint32_t>::max()
+        , vector<vector<lbool>>* repeats = NULL
     );
 
     void readInAFile(SATSolver* solver2, const string& filename);
@@ -200,6 +417,17 @@ private:
     double total_inter_simp_time = 0;
     uint32_t threshold; //precision, it's computed
     CuttingPlane* cutting_plane = NULL;
+    ActVars act_vars;
+    SampleSink* sink = NULL; //NULL: straight to the callback
+    vector<vector<int>>* kept_samples = NULL; //accepted samples to return
+    PackedBits packed_sample; //reused by every packed sample
+    size_t num_fixed_separated = 0; //level 0 literals fixed_separator_func last saw
+    //Only learnt clauses, added clauses and simplification fix literals at
+    //level 0. Until one of them happens the trail is not copied again
+    bool fixed_may_have_grown = true;
+    bool own_solver = false; //solver is a copy, not appmc's
+    SATSolver* ext_solver = NULL; //copy extending deferred models, made when first needed
+    uint64_t num_extended = 0; //deferred models extended
 };
 
 
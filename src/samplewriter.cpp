@@ -0,0 +1,139 @@
+/*
+ Buffered sample output on a writer thread
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "samplewriter.h"
+
+#include <cassert>
+#include <cstring>
+
+using std::vector;
+
+SampleWriter::SampleWriter(std::ostream* _os) :
+    os(_os)
+{
+    for (Buffer& b: buffers) {
+        b.data.resize(buffer_size);
+        free_bufs.push(&b);
+        num_free.post();
+    }
+    num_free.wait();
+    free_bufs.pop(cur);
+    writer = std::thread(&SampleWriter::run, this);
+}
+
+SampleWriter::~SampleWriter()
+{
+    finish();
+}
+
+void SampleWriter::reserve(const size_t len)
+{
+    if (cur->used + len > cur->data.size()) {
+        submit(false);
+        if (len > cur->data.size()) {
+            cur->data.resize(len);
+        }
+    }
+}
+
+void SampleWriter::write(const char* str, size_t len)
+{
+    reserve(len);
+    memcpy(cur->data.data() + cur->used, str, len);
+    cur->used += len;
+}
+
+void SampleWriter::write_int(int64_t x)
+{
+    char tmp[24];
+    size_t at = sizeof(tmp);
+    const bool neg = x < 0;
+    uint64_t v = neg ? -(uint64_t)x : (uint64_t)x;
+    do {
+        tmp[--at] = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    if (neg) {
+        tmp[--at] = '-';
+    }
+    write(tmp + at, sizeof(tmp) - at);
+}
+
+void SampleWriter::write_sample(const vector<int>& solution)
+{
+    //An int with its sign and the separator is at most 12 chars
+    reserve(solution.size() * 12 + 2);
+    for (const int lit: solution) {
+        write_int(lit);
+        cur->data[cur->used++] = ' ';
+    }
+    cur->data[cur->used++] = '0';
+    cur->data[cur->used++] = '\n';
+}
+
+//There are only as many buffers as slots, so pushing never fails
+void SampleWriter::submit(const bool flush)
+{
+    cur->flush = flush;
+    const bool pushed = full_bufs.push(cur);
+    assert(pushed);
+    (void)pushed;
+    num_full.post();
+
+    num_free.wait();
+    free_bufs.pop(cur);
+    cur->used = 0;
+}
+
+void SampleWriter::finish()
+{
+    if (!writer.joinable()) {
+        return;
+    }
+
+    submit(true);
+    //Nothing to pop for this one, the writer stops
+    num_full.post();
+    writer.join();
+}
+
+void SampleWriter::run()
+{
+    while (true) {
+        num_full.wait();
+        Buffer* b = NULL;
+        if (!full_bufs.pop(b)) {
+            return;
+        }
+
+        os->write(b->data.data(), b->used);
+        if (b->flush) {
+            os->flush();
+        }
+        const bool pushed = free_bufs.push(b);
+        assert(pushed);
+        (void)pushed;
+        num_free.post();
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ Buffered sample output on a writer thread
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef SAMPLEWRITER_H__
+#define SAMPLEWRITER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+//Fixed size ring handing pointers from exactly one producer thread to
+//exactly one consumer thread, without locks
+template<class T, size_t N>
+class SpscRing {
+public:
+    bool push(T x)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[t % N] = x;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& x)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        x = slots[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[N];
+    std::atomic<size_t> head {0};
+    std::atomic<size_t> tail {0};
+};
+
+//Counts the items in a ring, so that the side taking them out sleeps until
+//there is one instead of polling
+class RingCount {
+public:
+    void post()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            count++;
+        }
+        cv.notify_one();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [this]{ return count > 0; });
+        count--;
+    }
+
+private:
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t count = 0;
+};
+
+//Formats samples into large reusable buffers and writes them out on its own
+//thread. Full buffers are written as they fill up, the stream is only
+//flushed by finish(), which is called once all samples of a run are in.
+//All writes must come from one thread at a time.
+class SampleWriter {
+public:
+    explicit SampleWriter(std::ostream* os);
+    ~SampleWriter();
+
+    void write(const char* str, size_t len);
+    void write_char(const char c)
+    {
+        reserve(1);
+        cur->data[cur->used++] = c;
+    }
+    void write_int(int64_t x);
+    //DIMACS style: the literals followed by "0"
+    void write_sample(const std::vector<int>& solution);
+
+    //Writes out and flushes everything, then stops the writer thread
+    void finish();
+
+private:
+    struct Buffer {
+        std::vector<char> data;
+        size_t used = 0;
+        bool flush = false;
+    };
+    static constexpr size_t buffer_size = 1 << 20;
+    static constexpr size_t num_buffers = 4;
+
+    void reserve(const size_t len);
+    void submit(const bool flush);
+    void run();
+
+    std::ostream* os;
+    Buffer buffers[num_buffers];
+    Buffer* cur = NULL;
+    SpscRing<Buffer*, num_buffers> full_bufs; //to the writer thread
+    SpscRing<Buffer*, num_buffers> free_bufs; //back from it
+    RingCount num_full; //posted once more by finish() to stop the writer
+    RingCount num_free;
+    std::thread writer;
+};
+
+#endif //SAMPLEWRITER_H__
@@ -50,6 +50,7 @@ namespace UniGen {
         Sampler sampler;
         AppMC* appmc;
         Config conf;
+        InputFormula input;
     };
 }
 
@@ -58,6 +59,7 @@ using namespace UniGen;
 DLL_PUBLIC UniG::UniG(AppMC* appmc)
 {
     data = new UniGenPrivateData;
+    data->appmc = appmc;
     data->sampler.appmc = appmc;
 }
 
@@ -66,6 +68,48 @@ DLL_PUBLIC UniG::~UniG()
     delete data;
 }
 
+DLL_PUBLIC void UniG::set_record_input(bool record_input)
+{
+    if (data->input.num_vars > 0) {
+        std::cout << "ERROR! The input formula can only be recorded"
+        " from the first variable on" << endl;
+        exit(-1);
+    }
+    data->sampler.input = record_input ? &data->input : NULL;
+}
+
+DLL_PUBLIC void UniG::new_var()
+{
+    new_vars(1);
+}
+
+DLL_PUBLIC void UniG::new_vars(uint32_t n)
+{
+    data->appmc->new_vars(n);
+    data->input.num_vars += n;
+}
+
+DLL_PUBLIC uint32_t UniG::nVars()
+{
+    return data->appmc->nVars();
+}
+
+DLL_PUBLIC bool UniG::add_clause(const vector<CMSat::Lit>& lits)
+{
+    if (data->sampler.input != NULL) {
+        data->input.clauses.push_back(lits);
+    }
+    return data->appmc->add_clause(lits);
+}
+
+DLL_PUBLIC bool UniG::add_xor_clause(const vector<uint32_t>& vars, bool rhs)
+{
+    if (data->sampler.input != NULL) {
+        data->input.xors.push_back(std::make_pair(vars, rhs));
+    }
+    return data->appmc->add_xor_clause(vars, rhs);
+}
+
 DLL_PUBLIC void UniG::set_callback(
     UniGen::callback _callback_func,
     void* _callback_func_data)
@@ -74,12 +118,24 @@ DLL_PUBLIC void UniG::set_callback(
     data->sampler.callback_func_data = _callback_func_data;
 }
 
+DLL_PUBLIC void UniG::set_packed_callback(
+    UniGen::packed_callback _packed_func,
+    UniGen::packed_setup _packed_setup,
+    void* _packed_data)
+{
+    data->sampler.packed_callback_func = _packed_func;
+    data->sampler.packed_setup_func = _packed_setup;
+    data->sampler.packed_callback_data = _packed_data;
+}
+
 DLL_PUBLIC vector<vector<int>> UniG::sample(
     const SolCount* sol_count,
     uint32_t num_samples)
 {
-    if (data->sampler.callback_func == NULL) {
-        std::cout << "ERROR! You must set the callback function or your samples will be lost" << endl;
+    if (data->sampler.callback_func == NULL
+        && data->sampler.packed_callback_func == NULL
+    ) {
+        std::cout << "ERROR! You must set a callback function or your samples will be lost" << endl;
         exit(-1);
     }
     return data->sampler.sample(data->conf, *sol_count, num_samples);
@@ -140,6 +196,74 @@ DLL_PUBLIC void UniG::set_force_sol_extension(bool force_sol_extension)
     data->conf.force_sol_extension = force_sol_extension;
 }
 
+DLL_PUBLIC uint32_t UniG::get_defer_sol_extension()
+{
+    return data->conf.defer_sol_extension;
+}
+
+DLL_PUBLIC void UniG::set_defer_sol_extension(uint32_t defer_sol_extension)
+{
+    if (defer_sol_extension > 2) {
+        std::cout << "ERROR! Deferred solution extension must be 0, 1 or 2" << endl;
+        exit(-1);
+    }
+    data->conf.defer_sol_extension = defer_sol_extension;
+}
+
+DLL_PUBLIC uint32_t UniG::get_num_threads()
+{
+    return data->conf.num_threads;
+}
+
+DLL_PUBLIC void UniG::set_num_threads(uint32_t num_threads)
+{
+    if (num_threads == 0) {
+        std::cout << "ERROR! Number of threads must be at least 1" << endl;
+        exit(-1);
+    }
+    data->conf.num_threads = num_threads;
+}
+
+DLL_PUBLIC bool UniG::get_reservoir()
+{
+    return data->conf.reservoir;
+}
+
+DLL_PUBLIC void UniG::set_reservoir(bool reservoir)
+{
+    data->conf.reservoir = reservoir;
+}
+
+DLL_PUBLIC bool UniG::get_sparse_sampling()
+{
+    return data->conf.sparse_sampling;
+}
+
+DLL_PUBLIC void UniG::set_sparse_sampling(bool sparse_sampling)
+{
+    data->conf.sparse_sampling = sparse_sampling;
+}
+
+DLL_PUBLIC bool UniG::get_sink_only()
+{
+    return data->conf.sink_only;
+}
+
+DLL_PUBLIC void UniG::set_sink_only(bool sink_only)
+{
+    data->conf.sink_only = sink_only;
+}
+
+DLL_PUBLIC uint32_t UniG::get_sink_queue()
+{
+    return data->conf.sink_queue;
+}
+
+DLL_PUBLIC void UniG::set_sink_queue(uint32_t sink_queue)
+{
+    data->conf.sink_queue = sink_queue;
+}
+
 DLL_PUBLIC void UniG::set_logfile(std::ostream* logfile)
 {
     data->conf.logfile = logfile;
@@ -153,4 +277,28 @@ DLL_PUBLIC void UniG::set_verbosity(uint32_t verb)
 DLL_PUBLIC void UniG::set_cutting_plane(CuttingPlane* cutting_plane)
 {
     data->sampler.set_cutting_plane(cutting_plane);
-}
\ No newline at end of file
+}
+
+DLL_PUBLIC void UniG::set_fixed_separator(
+    UniGen::fixed_separator _separator_func,
+    void* _separator_func_data)
+{
+    data->sampler.fixed_separator_func = _separator_func;
+    data->sampler.fixed_separator_data = _separator_func_data;
+}
+
+DLL_PUBLIC void UniG::set_cutting_plane_factory(
+    UniGen::cutting_plane_factory _factory_func,
+    void* _factory_func_data)
+{
+    data->sampler.cutting_plane_factory_func = _factory_func;
+    data->sampler.cutting_plane_factory_data = _factory_func_data;
+}
+
+DLL_PUBLIC void UniG::set_cutting_plane_rebinder(
+    UniGen::cutting_plane_rebinder _rebinder_func,
+    void* _rebinder_func_data)
+{
+    data->sampler.cutting_plane_rebinder_func = _rebinder_func;
+    data->sampler.cutting_plane_rebinder_data = _rebinder_func_data;
+}
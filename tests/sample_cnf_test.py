@@ -0,0 +1,64 @@
+# Samples tests/cnf/small.cnf with one and several threads and checks that
+# every sample satisfies the input formula and that a fixed seed and thread
+# count give the same samples every run.
+#
+# usage: sample_cnf_test.py <unigen binary> <cnf>
+import os, subprocess, sys, tempfile
+
+NUM_SAMPLES = 40
+SEED = 7
+
+def read_cnf(filename):
+    clauses = []
+    with open(filename) as f:
+        for line in f:
+            if line.startswith('c') or line.startswith('p') or not line.strip():
+                continue
+            lits = [int(x) for x in line.split()]
+            assert lits[-1] == 0
+            clauses.append(lits[:-1])
+    return clauses
+
+def sample(unigen, cnf, threads, outdir, run):
+    out = os.path.join(outdir, f'samples_{threads}_{run}.txt')
+    command = [unigen, cnf, '--verb', '0', '--seed', str(SEED),
+               '--threads', str(threads), '--samples', str(NUM_SAMPLES),
+               '--sampleout', out]
+    subprocess.run(command, check=True, stdout=subprocess.DEVNULL)
+    with open(out) as f:
+        return f.read()
+
+def check_samples(text, clauses, threads):
+    samples = [line.split() for line in text.splitlines() if line.strip()]
+    if not samples:
+        return [f'{threads} threads: no samples']
+    errors = []
+    for num, sample in enumerate(samples):
+        assert sample[-1] == '0'
+        lits = set(int(x) for x in sample[:-1])
+        for clause in clauses:
+            if any(abs(lit) not in lits and -abs(lit) not in lits for lit in clause):
+                errors.append(f'{threads} threads: sample {num} misses a variable of {clause}')
+                break
+            if not any(lit in lits for lit in clause):
+                errors.append(f'{threads} threads: sample {num} falsifies {clause}')
+                break
+    return errors
+
+def main():
+    unigen, cnf = sys.argv[1], sys.argv[2]
+    clauses = read_cnf(cnf)
+    errors = []
+    with tempfile.TemporaryDirectory() as outdir:
+        for threads in [1, 4]:
+            first = sample(unigen, cnf, threads, outdir, 1)
+            second = sample(unigen, cnf, threads, outdir, 2)
+            errors += check_samples(first, clauses, threads)
+            if first != second:
+                errors.append(f'{threads} threads: two runs with seed {SEED} differ')
+    for error in errors:
+        print(error)
+    return 1 if errors else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
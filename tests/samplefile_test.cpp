@@ -0,0 +1,148 @@
+/*
+ Round trip of the binary sample file: written through the packed
+ callbacks, read back through the memory-mapped reader
+ */
+
+#include "samplefile.h"
+#include "packedbits.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using std::vector;
+using std::string;
+using std::cout;
+using std::endl;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            cout << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond << endl; \
+            failures++; \
+        } \
+    } while (0)
+
+static void test_round_trip(const uint32_t num_vars, const uint64_t num_samples)
+{
+    const string fname = "samplefile_test_" + std::to_string(num_vars) + ".bin";
+    const uint64_t seed = 12345;
+    vector<uint32_t> vars;
+    for (uint32_t j = 0; j < num_vars; j++) {
+        vars.push_back(3 * j + 1);
+    }
+
+    std::mt19937_64 rnd(num_vars);
+    vector<PackedBits> samples;
+    {
+        SampleFileWriter writer(fname, seed);
+        CHECK(writer.is_open());
+        SampleFileWriter::setup(vars, &writer);
+        for (uint64_t i = 0; i < num_samples; i++) {
+            PackedBits bits(packed_words(num_vars), 0);
+            for (uint32_t j = 0; j < num_vars; j++) {
+                if (rnd() & 1) {
+                    set_packed_bit(bits, j);
+                }
+            }
+            SampleFileWriter::add_sample(bits.data(), num_vars, &writer);
+            samples.push_back(bits);
+        }
+    }
+
+    SampleFileReader reader(fname);
+    CHECK(reader.is_open());
+    CHECK(reader.get_error().empty());
+    CHECK(reader.get_seed() == seed);
+    CHECK(reader.get_num_vars() == num_vars);
+    CHECK(reader.get_num_samples() == num_samples);
+    for (uint32_t j = 0; j < num_vars; j++) {
+        CHECK(reader.get_var(j) == vars[j]);
+    }
+    for (uint64_t i = 0; i < num_samples; i++) {
+        const vector<int> ints = reader.get_sample_ints(i);
+        CHECK(ints.size() == num_vars);
+        for (uint32_t j = 0; j < num_vars && j < ints.size(); j++) {
+            const bool value = get_packed_bit(samples[i], j);
+            CHECK(reader.get_value(i, j) == value);
+            CHECK(ints[j] == (value ? 1 : -1) * ((int)vars[j] + 1));
+        }
+    }
+
+    bool thrown = false;
+    try {
+        reader.get_sample(num_samples);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    std::remove(fname.c_str());
+}
+
+static void test_truncated()
+{
+    const string fname = "samplefile_test_truncated.bin";
+    vector<uint32_t> vars{0, 1, 2};
+    {
+        SampleFileWriter writer(fname, 1);
+        SampleFileWriter::setup(vars, &writer);
+        const uint64_t bits = 5;
+        for (int i = 0; i < 10; i++) {
+            SampleFileWriter::add_sample(&bits, vars.size(), &writer);
+        }
+    }
+
+    //Drop the last record
+    std::ifstream in(fname.c_str(), std::ios::binary);
+    string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream out(fname.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size() - sizeof(uint64_t));
+    out.close();
+
+    SampleFileReader reader(fname);
+    CHECK(!reader.is_open());
+    CHECK(!reader.get_error().empty());
+    CHECK(reader.get_num_samples() == 0);
+    std::remove(fname.c_str());
+}
+
+static void test_not_a_sample_file()
+{
+    SampleFileReader missing("samplefile_test_does_not_exist.bin");
+    CHECK(!missing.is_open());
+    CHECK(!missing.get_error().empty());
+
+    const string fname = "samplefile_test_text.bin";
+    std::ofstream out(fname.c_str());
+    out << "1 -2 3 0\n-1 2 -3 0\n";
+    out.close();
+    SampleFileReader text(fname);
+    CHECK(!text.is_open());
+    CHECK(!text.get_error().empty());
+    std::remove(fname.c_str());
+}
+
+int main()
+{
+    test_round_trip(1, 100);
+    test_round_trip(64, 257);
+    test_round_trip(70, 1000);
+    test_round_trip(130, 3);
+    test_round_trip(5, 0);
+    test_truncated();
+    test_not_a_sample_file();
+
+    if (failures != 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}